@@ -1,44 +1,125 @@
 #ifndef ARCHETYPE_H_
 #define ARCHETYPE_H_
 #include "UntypeContainer.h"
-#include <bitset>
+#include "Trace.h"
+#include "ComponentMask.hpp"
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
 #include <iostream>
 
+// Maximal amount of components in EntityView
+#ifndef YAECS_VIEW_CAPACITY
+    #define YAECS_VIEW_CAPACITY 8
+#endif
+
 namespace ECS
 {
+    // Id of the entity slot in registry, stays the same while entity is alive
+    using EntityId = uint32_t;
+    constexpr inline EntityId INVALID_ENTITY = std::numeric_limits<EntityId>::max();
+
+    // Archetype id used for transitions that were not resolved yet
+    constexpr inline size_t NO_ARCHETYPE = std::numeric_limits<size_t>::max();
+
     /*
         Dynamic view for an entity in archetype
         Only used for immediate access to its components, mostly needed for state machine
         Is outdated after most operations with even unrelated entities or components
+        Keeps up to YAECS_VIEW_CAPACITY component ids and pointers inline, so creating it never allocates
+        and lookup is a scan over a few ids
+        Non-const access to change tracked components marks them as changed with the current tick, get<const T> only reads
     */
     class EntityView
     {
     public:
+        static constexpr size_t CAPACITY = YAECS_VIEW_CAPACITY;
+
+        EntityView() = default;
+
+        explicit EntityView(const std::atomic<Tick> *tickSource_) :
+            m_tickSource(tickSource_)
+        {
+        }
+
         template<typename TReg, typename T>
         T &get()
         {
-            return *static_cast<T*>(m_components[TReg::template Get<T>()]);
+            return get<T>(TReg::template Get<std::remove_const_t<T>>());
         }
 
         template<typename T>
         T &get(std::size_t comp_)
         {
-            return *static_cast<T*>(m_components[comp_]);
+            if constexpr (!std::is_const_v<T> && IS_CHANGE_TRACKED<T>)
+                markChanged(comp_);
+
+            return *static_cast<T*>(find(comp_));
         }
 
         template<typename TReg, typename T>
         bool contains() const
         {
-            return m_components.contains(TReg::template Get<T>());
+            return find(TReg::template Get<std::remove_const_t<T>>()) != nullptr;
         }
 
-        void add(int id_, void* comp_)
+        // Replaces pointers if component is already in view, throws if view is full, changed_ is nullptr for components without ticks
+        void add(int id_, void* comp_, Tick *changed_ = nullptr)
         {
-            m_components[id_] = comp_;
+            for (size_t i = 0; i < m_size; ++i)
+            {
+                if (m_ids[i] == id_)
+                {
+                    m_components[i] = comp_;
+                    m_changed[i] = changed_;
+                    return;
+                }
+            }
+
+            if (m_size == CAPACITY)
+                throw std::exception();
+
+            m_ids[m_size] = id_;
+            m_changed[m_size] = changed_;
+            m_components[m_size++] = comp_;
+        }
+
+        size_t size() const
+        {
+            return m_size;
         }
 
     private:
-        std::unordered_map<int, void*> m_components;
+        void *find(std::size_t comp_) const
+        {
+            for (size_t i = 0; i < m_size; ++i)
+            {
+                if (m_ids[i] == static_cast<int>(comp_))
+                    return m_components[i];
+            }
+
+            return nullptr;
+        }
+
+        // Tick is read at the moment of access, so views that live across query runs still mark with the current one
+        void markChanged(std::size_t comp_)
+        {
+            for (size_t i = 0; i < m_size; ++i)
+            {
+                if (m_ids[i] == static_cast<int>(comp_) && m_changed[i])
+                    *m_changed[i] = m_tickSource ? m_tickSource->load(std::memory_order_relaxed) : 0;
+            }
+        }
+
+        std::array<int, CAPACITY> m_ids;
+        std::array<void*, CAPACITY> m_components;
+        std::array<Tick*, CAPACITY> m_changed;
+        size_t m_size = 0;
+        const std::atomic<Tick> *m_tickSource = nullptr;
     };
 
     /*
@@ -46,6 +127,14 @@ namespace ECS
         A container for a number of component containers
         These components should be defined once right after initialization
         Its technically possible to add new components, but it most likely will have wrong capacity and size
+        Only columns of its own components are stored, in ascending order of their ids, and a table from component id
+        to column slot resolves them, so access to a component is two indexed loads without hashing
+        and archetypes stay small no matter how many components registry has
+        Additionally keeps reverse column with entity id of every row so registry can patch its slots when rows move
+        and a cache of transitions to archetypes with a single component added or removed
+        If growth policy has chunk size, rows are stored in chunks of a single ChunkStorage, every chunk holds
+        entity ids, components and ticks of its rows, so rows of a chunk can be walked with plain pointers,
+        while growing only allocates a new chunk and never moves rows (see getChunkEnd)
     */
     template<typename TReg>
     class Archetype
@@ -57,13 +146,43 @@ namespace ECS
         Archetype &operator=(const Archetype<TReg> &rhs_) = delete;
 
         Archetype(Archetype<TReg> &&rhs_) :
-            m_map(std::move(rhs_.m_map))
+            m_storage(std::move(rhs_.m_storage)),
+            m_columns(std::move(rhs_.m_columns)),
+            m_componentIds(std::move(rhs_.m_componentIds)),
+            m_slots(std::move(rhs_.m_slots)),
+            m_entities(std::move(rhs_.m_entities)),
+            m_addEdges(std::move(rhs_.m_addEdges)),
+            m_removeEdges(std::move(rhs_.m_removeEdges)),
+            m_mask(rhs_.m_mask),
+            m_size(rhs_.m_size),
+            m_growth(rhs_.m_growth),
+            m_chunkRows(rhs_.m_chunkRows),
+            m_tickSource(rhs_.m_tickSource)
         {
+            rhs_.m_mask.reset();
+            rhs_.m_size = 0;
         }
 
         Archetype &operator=(Archetype<TReg> &&rhs_)
         {
-            m_map = std::move(rhs_.m_map);
+            // Old columns are destroyed while their chunks are still alive
+            m_columns = std::move(rhs_.m_columns);
+            m_storage = std::move(rhs_.m_storage);
+            m_componentIds = std::move(rhs_.m_componentIds);
+            m_slots = std::move(rhs_.m_slots);
+            m_entities = std::move(rhs_.m_entities);
+            m_addEdges = std::move(rhs_.m_addEdges);
+            m_removeEdges = std::move(rhs_.m_removeEdges);
+            m_mask = rhs_.m_mask;
+            m_size = rhs_.m_size;
+            m_growth = rhs_.m_growth;
+            m_chunkRows = rhs_.m_chunkRows;
+            m_tickSource = rhs_.m_tickSource;
+
+            rhs_.m_mask.reset();
+            rhs_.m_size = 0;
+
+            return *this;
         }
 
         // Reserves all specified components if they werent reserved already
@@ -71,6 +190,7 @@ namespace ECS
         void addTypes(int reserve_)
         {
             (addType<Ts>(reserve_), ...);
+            updateLayout();
         }
 
         // Reserves all specified components and components in another Archetype if they werent reserved already
@@ -78,6 +198,7 @@ namespace ECS
         void addTypes(const Archetype<TReg> &copied_, int reserve_)
         {
             iterateAddTypes<1, Ts...>(copied_, reserve_);
+            updateLayout();
         }
 
         // Reserves all components from another archetype except listed ones
@@ -85,49 +206,205 @@ namespace ECS
         void addTypesReduced(const Archetype<TReg> &copied_, int reserve_)
         {
             iterateAddTypesExceptListed<1, Ts...>(copied_, reserve_);
+            updateLayout();
         }
 
 
         template<typename... Ts> requires TypeManip::TemplateExists<Ts...>
         bool containsComponents() const
         {
-            return (m_map.contains(TReg::template Get<Ts>()) && ...);
+            return (m_mask[TReg::template Get<Ts>() - 1] && ...);
         }
 
         bool containsComponent(int comp_) const
         {
-            return (m_map.contains(comp_));
+            return m_mask[comp_ - 1];
         }
 
         inline size_t size() const
         {
-            return m_map.begin()->second.size();
+            return m_size;
         }
 
-        template<typename... Ts> requires TypeManip::TemplateExists<Ts...>
-        void addEntity(Ts&&... ts_)
+        // Ensures that all columns can hold at least capacity_ rows without reallocation
+        void reserve(size_t capacity_)
+        {
+            for (auto &col : m_columns)
+                col.reserve(capacity_);
+
+            if (m_chunkRows)
+                m_storage->grow(capacity_);
+            else
+                m_entities.reserve(capacity_);
+        }
+
+        // Applies to all existing columns and columns added later, chunk size only applies while archetype is empty
+        void setGrowthPolicy(const GrowthPolicy &growth_)
+        {
+            m_growth = growth_;
+            for (auto &col : m_columns)
+                col.setGrowthPolicy(m_growth);
+
+            updateLayout();
+        }
+
+        inline const GrowthPolicy &getGrowthPolicy() const
+        {
+            return m_growth;
+        }
+
+        // Applies to all existing columns and columns added later
+        void setTickSource(const std::atomic<Tick> *tickSource_)
+        {
+            m_tickSource = tickSource_;
+            for (auto &col : m_columns)
+                col.setTickSource(m_tickSource);
+        }
+
+        // Marks component of the row as changed at the current tick
+        template<typename Comp>
+        inline void markChanged(std::size_t ent_)
+        {
+            column<Comp>().markChanged(ent_);
+        }
+
+        // Ticks of the component starting from the row, ticks of following rows are contiguous up to getChunkEnd(row_)
+        // nullptr if component is not change tracked
+        inline const Tick *getAddedTicks(int comp_, std::size_t row_ = 0) const
         {
-            size_t cnt = 0;
+            return columnById(comp_).addedTicks(row_);
+        }
+
+        inline Tick *getChangedTicks(int comp_, std::size_t row_ = 0)
+        {
+            return columnById(comp_).changedTicks(row_);
+        }
+
+        /*
+            Adds new row, passed components are constructed in place from arguments,
+            the rest are default constructed
+            Returns index of the new row
+        */
+        template<typename... Ts>
+        size_t addEntity(EntityId entity_, Ts&&... ts_)
+        {
+            ComponentMask<TReg::MaxID> passed;
+            pushComponents(passed, std::forward<Ts>(ts_)...);
+
+            for (size_t slot = 0; slot < m_columns.size(); ++slot)
+            {
+                if (!passed[m_componentIds[slot] - 1])
+                    m_columns[slot].push_back();
+            }
+
+            growEntities(1);
+            entityAt(m_size) = entity_;
+            return m_size++;
+        }
+
+        /*
+            Adds a row for every passed entity id, every column grows at most once
+            Components with sources are constructed from BatchSource, the rest are default constructed
+            Returns index of the first new row
+        */
+        template<typename... Sources>
+        size_t addEntities(const EntityId *entities_, size_t count_, Sources&&... sources_)
+        {
+            ComponentMask<TReg::MaxID> passed;
             ([&]
             {
-                if (m_map.contains(TReg::template Get<Ts>()))
-                {
-                    m_map[TReg::template Get<Ts>()].push_back(std::forward<Ts>(ts_));
-                    cnt++;
-                }
+                using T = BatchComponent<Sources>;
+                constexpr int id = TReg::template Get<T>();
+                if (!m_mask[id - 1])
+                    throw std::exception();
+
+                columnById(id).template append<T>(count_, sources_);
+                passed.set(id - 1);
             } (), ...);
 
-            if (cnt < m_map.size())
-                throw std::exception();
+            for (size_t slot = 0; slot < m_columns.size(); ++slot)
+            {
+                if (!passed[m_componentIds[slot] - 1])
+                    m_columns[slot].appendDefault(count_);
+            }
+
+            growEntities(count_);
+            for (size_t i = 0; i < count_; ++i)
+                entityAt(m_size + i) = entities_[i];
+
+            auto first = m_size;
+            m_size += count_;
+            return first;
+        }
+
+        /*
+            Adds new row, passed components are constructed from arguments,
+            the rest are moved from the row of another archetype if it has them or default constructed otherwise
+            Moved from row is left for the caller to remove
+        */
+        template<typename... Ts>
+        size_t addEntityFrom(EntityId entity_, Archetype<TReg> &src_, size_t srcRow_, Ts&&... ts_)
+        {
+            ComponentMask<TReg::MaxID> passed;
+            pushComponents(passed, std::forward<Ts>(ts_)...);
+
+            for (size_t slot = 0; slot < m_columns.size(); ++slot)
+            {
+                auto id = m_componentIds[slot];
+                if (passed[id - 1])
+                    continue;
+
+                if (src_.m_mask[id - 1])
+                    m_columns[slot].pushFrom(src_.columnById(id), srcRow_);
+                else
+                    m_columns[slot].push_back();
+            }
+
+            growEntities(1);
+            entityAt(m_size) = entity_;
+            return m_size++;
         }
 
-        size_t addEntity()
+        /*
+            Adds a row for every listed row of another archetype, every column grows at most once
+            Components with sources are constructed from BatchSource, i-th source element goes to i-th listed row,
+            the rest are moved from the other archetype if it has them or default constructed otherwise
+            Moved from rows are left for the caller to remove, returns index of the first new row
+        */
+        template<typename... Sources>
+        size_t addEntitiesFrom(Archetype<TReg> &src_, const size_t *rows_, size_t count_, Sources&&... sources_)
         {
-            for (auto &el : m_map)
+            ComponentMask<TReg::MaxID> passed;
+            ([&]
             {
-                el.second.push_back();
+                using T = BatchComponent<Sources>;
+                constexpr int id = TReg::template Get<T>();
+                if (!m_mask[id - 1])
+                    throw std::exception();
+
+                columnById(id).template append<T>(count_, sources_);
+                passed.set(id - 1);
+            } (), ...);
+
+            for (size_t slot = 0; slot < m_columns.size(); ++slot)
+            {
+                auto id = m_componentIds[slot];
+                if (passed[id - 1])
+                    continue;
+
+                if (src_.m_mask[id - 1])
+                    m_columns[slot].appendFrom(src_.columnById(id), rows_, count_);
+                else
+                    m_columns[slot].appendDefault(count_);
             }
-            return size() - 1;
+
+            growEntities(count_);
+            for (size_t i = 0; i < count_; ++i)
+                entityAt(m_size + i) = src_.entityAt(rows_[i]);
+
+            auto first = m_size;
+            m_size += count_;
+            return first;
         }
 
         template<typename... Ts>
@@ -135,9 +412,9 @@ namespace ECS
         {
             ([&]
             {
-                if (m_map.contains(TReg::template Get<Ts>()))
+                if (containsComponents<std::remove_cvref_t<Ts>>())
                 {
-                    m_map[TReg::template Get<Ts>()].emplace(std::forward<Ts>(comps_), id_);
+                    column<Ts>().emplace(std::forward<Ts>(comps_), id_);
                 }
                 else
                 {
@@ -146,12 +423,69 @@ namespace ECS
             } (), ...);
         }
 
-        inline void removeEntity(size_t entity_)
+        // Removes entity by moving last one in its place, returns id of moved entity or INVALID_ENTITY if nothing was moved
+        inline EntityId removeEntity(size_t entity_)
+        {
+            if (entity_ >= m_size)
+                return INVALID_ENTITY;
+
+            for (auto &col : m_columns)
+            {
+                col.removeAt(entity_);
+            }
+            --m_size;
+
+            if (entity_ == m_size)
+            {
+                shrinkEntities();
+                return INVALID_ENTITY;
+            }
+
+            entityAt(entity_) = entityAt(m_size);
+            shrinkEntities();
+            return entityAt(entity_);
+        }
+
+        /*
+            Removes all listed rows in a single pass, rows are expected to be sorted and unique
+            Kept rows from the end are moved into the holes, returns indexes of the holes that were filled
+        */
+        std::vector<size_t> removeEntities(const size_t *rows_, size_t count_)
         {
-            for (auto &el : m_map)
+            std::vector<size_t> holes;
+            if (count_ == 0)
+                return holes;
+
+            const auto newSize = m_size - count_;
+            std::vector<size_t> fillers;
+
+            size_t removed = 0;
+            while (removed < count_ && rows_[removed] < newSize)
+                holes.push_back(rows_[removed++]);
+
+            for (size_t row = newSize; row < m_size; ++row)
             {
-                el.second.removeAt(entity_);
+                if (removed < count_ && rows_[removed] == row)
+                    removed++;
+                else
+                    fillers.push_back(row);
             }
+
+            for (auto &col : m_columns)
+                col.compact(holes.data(), fillers.data(), holes.size(), newSize);
+
+            for (size_t i = 0; i < holes.size(); ++i)
+                entityAt(holes[i]) = entityAt(fillers[i]);
+
+            m_size = newSize;
+            shrinkEntities();
+
+            return holes;
+        }
+
+        inline EntityId getEntity(size_t ent_) const
+        {
+            return entityAt(ent_);
         }
 
         void dumpAll()
@@ -169,59 +503,278 @@ namespace ECS
             std::cout << std::endl;
         }
 
+        // Non-const access to a change tracked component marks it as changed, getComponent<const Comp> only reads
+        template<typename Comp>
+        inline Comp &getComponent(std::size_t ent_)
+        {
+            auto &col = column<Comp>();
+            if constexpr (!std::is_const_v<Comp> && IS_CHANGE_TRACKED<Comp>)
+                col.markChanged(ent_);
+
+            return col.template get<Comp>(ent_);
+        }
+
+        // Pointer to the component of the row, components of following rows are contiguous up to getChunkEnd(row_)
+        // Becomes invalid after the column grows without chunks
         template<typename Comp>
-        Comp &getComponent(std::size_t ent_)
+        inline Comp *getColumn(std::size_t row_ = 0)
+        {
+            return column<Comp>().template data<Comp>(row_);
+        }
+
+        // Rows per chunk, 0 if every column is a single array
+        inline size_t getChunkRows() const
+        {
+            return m_chunkRows;
+        }
+
+        // First row of the chunk with row_
+        inline size_t getChunkBegin(size_t row_) const
         {
-            return m_map[TReg::template Get<Comp>()].template get<Comp>(ent_);
+            return m_chunkRows ? row_ & ~(m_chunkRows - 1) : 0;
         }
 
+        // End of the chunk with row_, limited by amount of rows, rows in between are stored contiguously in every column
+        inline size_t getChunkEnd(size_t row_) const
+        {
+            return m_chunkRows ? std::min(m_size, (row_ | (m_chunkRows - 1)) + 1) : m_size;
+        }
+
+        // Components that archetype doesn't have are skipped
         template<typename... Comps>
         EntityView makeView(size_t ent_)
         {
-            EntityView view;
+            static_assert(sizeof...(Comps) <= EntityView::CAPACITY, "Too many components for EntityView, increase YAECS_VIEW_CAPACITY");
+
+            EntityView view(m_tickSource);
             ([&]
             {
-                //std::cout << TReg::template Get<Comps>() << std::endl;
-                if (m_map.contains(TReg::template Get<Comps>()))
+                if (containsComponents<Comps>())
                 {
-                    //std::cout << "Contained\n";
-                    view.add(TReg::template Get<Comps>(), &(m_map[TReg::template Get<Comps>()].get<Comps>(ent_)));
+                    auto &col = column<Comps>();
+                    view.add(TReg::template Get<Comps>(), &col.template get<Comps>(ent_), col.changedTicks(ent_));
                 }
             } (), ...);
 
             return view;
         }
         
-        std::bitset<TReg::MaxID> getMask() const
+        inline const ComponentMask<TReg::MaxID> &getMask() const
+        {
+            return m_mask;
+        }
+
+        // Id of archetype with this archetype's components plus comp_, NO_ARCHETYPE if its not known yet
+        inline size_t getAddEdge(int comp_) const
+        {
+            return findEdge(m_addEdges, comp_);
+        }
+
+        // Id of archetype with this archetype's components except comp_, NO_ARCHETYPE if its not known yet
+        inline size_t getRemoveEdge(int comp_) const
+        {
+            return findEdge(m_removeEdges, comp_);
+        }
+
+        inline void setAddEdge(int comp_, size_t archId_)
         {
-            std::bitset<TReg::MaxID> bset(0);
-            for (auto &el : m_map)
-                bset[el.first - 1] = 1;
-            
-            return bset;
+            m_addEdges[comp_] = archId_;
+        }
+
+        inline void setRemoveEdge(int comp_, size_t archId_)
+        {
+            m_removeEdges[comp_] = archId_;
         }
 
     private:
-        std::unordered_map<int, UntypeContainer> m_map;
+        // Declared before columns, so it outlives elements that columns destroy, kept on heap so columns can point to it when archetype is moved
+        std::unique_ptr<ChunkStorage> m_storage = std::make_unique<ChunkStorage>();
+        std::vector<UntypeContainer> m_columns; // Only allocated columns, in the same order as their ids
+        std::vector<int> m_componentIds; // Ids of allocated columns in ascending order
+        std::vector<uint16_t> m_slots; // Column slot by component id - 1, only goes up to the largest id of archetype
+        std::vector<EntityId> m_entities; // Registry entity id of every row, only used without chunks, otherwise ids are at the start of every chunk
+        std::unordered_map<int, size_t> m_addEdges; // Archetype id by component id, only for transitions that were resolved
+        std::unordered_map<int, size_t> m_removeEdges;
+        ComponentMask<TReg::MaxID> m_mask;
+        size_t m_size = 0;
+        GrowthPolicy m_growth;
+        size_t m_chunkRows = 0;
+        const std::atomic<Tick> *m_tickSource = nullptr;
+
+        static_assert(TReg::MaxID < std::numeric_limits<uint16_t>::max(), "Too many components for column slots");
+
+        // Component should be present in archetype
+        template<typename T>
+        inline UntypeContainer &column()
+        {
+            return columnById(TReg::template Get<std::remove_cvref_t<T>>());
+        }
+
+        inline UntypeContainer &columnById(int comp_)
+        {
+            return m_columns[m_slots[comp_ - 1]];
+        }
+
+        inline const UntypeContainer &columnById(int comp_) const
+        {
+            return m_columns[m_slots[comp_ - 1]];
+        }
+
+        static size_t findEdge(const std::unordered_map<int, size_t> &edges_, int comp_)
+        {
+            auto it = edges_.find(comp_);
+            return it == edges_.end() ? NO_ARCHETYPE : it->second;
+        }
+
+        inline EntityId &entityAt(size_t row_) const
+        {
+            if (m_chunkRows)
+                return reinterpret_cast<EntityId*>(m_storage->getChunk(row_))[m_storage->getOffset(row_)];
+
+            return const_cast<EntityId&>(m_entities[row_]);
+        }
+
+        // Makes room for entity ids of count_ rows after the last one
+        void growEntities(size_t count_)
+        {
+            if (m_chunkRows)
+                m_storage->grow(m_size + count_);
+            else
+                m_entities.resize(m_size + count_);
+        }
+
+        // Drops entity ids after the last row
+        void shrinkEntities()
+        {
+            if (!m_chunkRows)
+                m_entities.resize(m_size);
+        }
+
+        // Constructs passed components at the end of their columns and marks them, throws if there is no such column
+        template<typename... Ts>
+        void pushComponents(ComponentMask<TReg::MaxID> &passed_, Ts&&... ts_)
+        {
+            ([&]
+            {
+                constexpr int id = TReg::template Get<std::remove_cvref_t<Ts>>();
+                if (!m_mask[id - 1])
+                    throw std::exception();
+
+                columnById(id).push_back(std::forward<Ts>(ts_));
+                passed_.set(id - 1);
+            } (), ...);
+        }
 
         template<typename T>
         void addType(int reserve_)
         {
-            if (!m_map.contains(TReg::template Get<T>()))
-                m_map[TReg::template Get<T>()].template allocate<T>(reserve_);
+            constexpr int id = TReg::template Get<T>();
+            if (m_mask[id - 1])
+                return;
+
+            auto pos = std::upper_bound(m_componentIds.begin(), m_componentIds.end(), id) - m_componentIds.begin();
+            auto &col = *m_columns.emplace(m_columns.begin() + pos);
+            col.template allocate<T>(m_growth.m_chunkSize ? 0 : reserve_);
+            col.setGrowthPolicy(m_growth);
+            col.setTickSource(m_tickSource);
+            m_mask.set(id - 1);
+            m_componentIds.insert(m_componentIds.begin() + pos, id);
+
+            // Columns after the new one have shifted
+            m_slots.resize(std::max<size_t>(m_slots.size(), id));
+            for (size_t slot = pos; slot < m_componentIds.size(); ++slot)
+                m_slots[m_componentIds[slot] - 1] = static_cast<uint16_t>(slot);
+        }
+
+        /*
+            Picks the largest power of two rows that fit into chunk size with all components, their ticks and entity ids, at least 1
+            Layout of an archetype that already has rows is kept as is
+        */
+        void updateLayout()
+        {
+            if (m_size > 0)
+                return;
+
+            size_t rows = 0;
+            if (m_growth.m_chunkSize > 0)
+            {
+                // Without padding, which might take the last power of two
+                size_t rowSize = sizeof(EntityId);
+                for (const auto &col : m_columns)
+                    rowSize += col.entrySize() + (col.tracksChanges() ? 2 * sizeof(Tick) : 0);
+
+                rows = std::bit_floor(std::max<size_t>(m_growth.m_chunkSize / rowSize, 1));
+                while (rows > 1 && layoutChunk(rows, false) > m_growth.m_chunkSize)
+                    rows /= 2;
+            }
+
+            m_chunkRows = rows;
+            if (!rows)
+            {
+                m_storage->setLayout(0, 0, alignof(Tick));
+                for (auto &col : m_columns)
+                {
+                    if (col.getChunkRows())
+                        col.setChunks(nullptr, 0, 0, 0);
+                }
+
+                return;
+            }
+
+            size_t alignment = alignof(Tick);
+            for (const auto &col : m_columns)
+                alignment = std::max(alignment, col.entryAlign());
+
+            m_storage->setLayout(rows, layoutChunk(rows, false), alignment);
+            layoutChunk(rows, true);
+        }
+
+        /*
+            Size of a chunk with rows_ rows: entity ids, then elements, added and changed ticks of every column,
+            columns that don't track changes have no ticks
+            Passes offsets to columns if apply_ is true
+        */
+        size_t layoutChunk(size_t rows_, bool apply_)
+        {
+            auto alignUp = [](size_t offset_, size_t alignment_)
+            {
+                return (offset_ + alignment_ - 1) / alignment_ * alignment_;
+            };
+
+            size_t offset = rows_ * sizeof(EntityId);
+            for (auto &col : m_columns)
+            {
+                auto data = alignUp(offset, col.entryAlign());
+                offset = data + rows_ * col.entrySize();
+                if (!col.tracksChanges())
+                {
+                    if (apply_)
+                        col.setChunks(m_storage.get(), data, 0, 0);
+
+                    continue;
+                }
+
+                auto ticks = alignUp(offset, alignof(Tick));
+                if (apply_)
+                    col.setChunks(m_storage.get(), data, ticks, ticks + rows_ * sizeof(Tick));
+
+                offset = ticks + 2 * rows_ * sizeof(Tick);
+            }
+
+            return offset;
         }
 
         template<int CurrentType, typename... Ts>
         void iterateAddTypes(const Archetype<TReg> &copied_, int reserve_)
         {
-            std::cout << CurrentType << std::endl;
+            ECS_TRACE(VERBOSE, ARCHETYPE, "Checking component " << CurrentType);
             if constexpr (TypeManip::isListed<typename TReg::template GetById<CurrentType>, Ts...>())
             {
                 addType<typename TReg::template GetById<CurrentType>>(reserve_);
             }
             else
             {
-                if (copied_.containsComponents<typename TReg::template GetById<CurrentType>>())
+                if (copied_.template containsComponents<typename TReg::template GetById<CurrentType>>())
                     addType<typename TReg::template GetById<CurrentType>>(reserve_);
             }
 
@@ -234,7 +787,7 @@ namespace ECS
         {
             if constexpr (!TypeManip::isListed<typename TReg::template GetById<CurrentType>, Ts...>())
             {
-                if (copied_.containsComponents<typename TReg::template GetById<CurrentType>>())
+                if (copied_.template containsComponents<typename TReg::template GetById<CurrentType>>())
                     addType<typename TReg::template GetById<CurrentType>>(reserve_);
             }
 
@@ -245,9 +798,9 @@ namespace ECS
         template<int current, int max>
         void dumpEntityComponents(size_t ent_)
         {
-            if (m_map.contains(current))
+            if (m_mask[current - 1])
             {
-                std::cout << m_map[current].template get<typename TReg::template GetById<current>>(ent_) << ", ";
+                std::cout << columnById(current).template get<typename TReg::template GetById<current>>(ent_) << ", ";
             }
 
             if constexpr (current < max)
@@ -0,0 +1,98 @@
+#ifndef ARCHETYPE_INDEX_H_
+#define ARCHETYPE_INDEX_H_
+#include "ComponentMask.hpp"
+#include "Archetype.hpp"
+#include <vector>
+#include <cstddef>
+
+namespace ECS
+{
+    /*
+        Map from component mask to archetype id
+        Open addressing with linear probing in a single power of two array, kept at most half full
+        Every slot keeps hash of its mask, so probing compares masks only when hashes match
+        Masks can be hashed in advance (for example, at compile time) and passed to find and insert
+        Archetypes are never removed, so there is no erase
+    */
+    template<size_t Bits>
+    class ArchetypeIndex
+    {
+    public:
+        using Mask = ComponentMask<Bits>;
+
+        // Id of archetype with this mask or NO_ARCHETYPE
+        size_t find(const Mask &mask_, size_t hash_) const
+        {
+            if (m_slots.empty())
+                return NO_ARCHETYPE;
+
+            for (size_t i = hash_ & (m_slots.size() - 1);; i = (i + 1) & (m_slots.size() - 1))
+            {
+                const auto &slot = m_slots[i];
+                if (slot.m_archId == NO_ARCHETYPE)
+                    return NO_ARCHETYPE;
+
+                if (slot.m_hash == hash_ && slot.m_mask == mask_)
+                    return slot.m_archId;
+            }
+        }
+
+        size_t find(const Mask &mask_) const
+        {
+            return find(mask_, mask_.hash());
+        }
+
+        // Mask is expected to be new
+        void insert(const Mask &mask_, size_t hash_, size_t archId_)
+        {
+            if ((m_size + 1) * 2 > m_slots.size())
+                rehash(std::max<size_t>(m_slots.size() * 2, 16));
+
+            place({hash_, archId_, mask_});
+            m_size++;
+        }
+
+        void insert(const Mask &mask_, size_t archId_)
+        {
+            insert(mask_, mask_.hash(), archId_);
+        }
+
+        size_t size() const
+        {
+            return m_size;
+        }
+
+    private:
+        struct Slot
+        {
+            size_t m_hash = 0;
+            size_t m_archId = NO_ARCHETYPE;
+            Mask m_mask;
+        };
+
+        void place(const Slot &slot_)
+        {
+            size_t i = slot_.m_hash & (m_slots.size() - 1);
+            while (m_slots[i].m_archId != NO_ARCHETYPE)
+                i = (i + 1) & (m_slots.size() - 1);
+
+            m_slots[i] = slot_;
+        }
+
+        void rehash(size_t capacity_)
+        {
+            auto old = std::move(m_slots);
+            m_slots.assign(capacity_, Slot{});
+            for (const auto &el : old)
+            {
+                if (el.m_archId != NO_ARCHETYPE)
+                    place(el);
+            }
+        }
+
+        std::vector<Slot> m_slots;
+        size_t m_size = 0;
+    };
+}
+
+#endif
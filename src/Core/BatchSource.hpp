@@ -0,0 +1,59 @@
+#ifndef BATCH_SOURCE_H_
+#define BATCH_SOURCE_H_
+#include <concepts>
+#include <cstddef>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+namespace ECS
+{
+    /*
+        Describes how batch operations get a component for i-th entity of a batch
+        Any object is treated as a prototype and copied into every entity,
+        std::span provides one component per entity (elements of non-const spans are moved),
+        callable with size_t argument is a generator that is called with index within the batch
+    */
+    template<typename S>
+    struct BatchSource
+    {
+        using Component = S;
+
+        static const Component &get(const S &src_, std::size_t)
+        {
+            return src_;
+        }
+    };
+
+    template<typename T, std::size_t Extent>
+    struct BatchSource<std::span<T, Extent>>
+    {
+        using Component = std::remove_const_t<T>;
+
+        static decltype(auto) get(const std::span<T, Extent> &src_, std::size_t id_)
+        {
+            if constexpr (std::is_const_v<T>)
+                return static_cast<const Component&>(src_[id_]);
+            else
+                return static_cast<Component&&>(src_[id_]);
+        }
+    };
+
+    template<typename S> requires std::invocable<S&, std::size_t>
+    struct BatchSource<S>
+    {
+        using Component = std::remove_cvref_t<std::invoke_result_t<S&, std::size_t>>;
+
+        // Takes the generator as it was passed, so const and temporary generators work as well as mutable ones
+        template<typename Src>
+        static decltype(auto) get(Src &&src_, std::size_t id_)
+        {
+            return std::forward<Src>(src_)(id_);
+        }
+    };
+
+    template<typename S>
+    using BatchComponent = typename BatchSource<std::remove_cvref_t<S>>::Component;
+}
+
+#endif
@@ -0,0 +1,331 @@
+#ifndef COMMAND_BUFFER_H_
+#define COMMAND_BUFFER_H_
+#include "yaECS.hpp"
+#include <typeindex>
+#include <memory>
+#include <tuple>
+#include <array>
+#include <iterator>
+#include <unordered_map>
+
+namespace ECS
+{
+    /*
+        Records structural changes to apply them later, mostly needed to change entities while iterating over queries
+        Commands are applied in fixed order of kinds: creations, component additions, component removals, removals of entities
+        Within a kind commands are applied in recording order, grouped by signature / component and source archetype,
+        so every group is a single batch operation
+        Entities are referenced with handles, commands for entities that are not alive at the moment of applying are skipped
+        Several buffers (for example, one per thread) can be merged into one, result depends only on the order of merging
+    */
+    template<typename TReg>
+    class CommandBuffer
+    {
+    public:
+        CommandBuffer() = default;
+
+        CommandBuffer(const CommandBuffer &rhs_) = delete;
+        CommandBuffer &operator=(const CommandBuffer &rhs_) = delete;
+        CommandBuffer(CommandBuffer &&rhs_) = default;
+        CommandBuffer &operator=(CommandBuffer &&rhs_) = default;
+
+        // Same as Registry::createEntity
+        template<typename... Comps, typename... Emplaced> requires TypeManip::TemplateExists<Comps...>
+        void createEntity(Emplaced&&... comps_)
+        {
+            using Queue_t = CreateQueue<TypeManip::Typelist<Comps...>, std::remove_cvref_t<Emplaced>...>;
+            auto &queue = getCreateQueue<Queue_t>();
+            queue.m_components.emplace_back(std::forward<Emplaced>(comps_)...);
+        }
+
+        void removeEntity(const EntityHandle &ent_)
+        {
+            m_removedEntities.push_back(ent_);
+        }
+
+        // Same as Registry::emplaceComponents, if the same component is emplaced several times, last one is used
+        template<typename... Comps> requires TypeManip::TemplateExists<Comps...>
+        void emplaceComponents(const EntityHandle &ent_, Comps&&... comps_)
+        {
+            ([&]
+            {
+                using T = std::remove_cvref_t<Comps>;
+                auto &queue = getAddQueue<T>();
+                queue.m_entities.push_back(ent_);
+                queue.m_components.push_back(std::forward<Comps>(comps_));
+            } (), ...);
+        }
+
+        template<typename... Comps> requires TypeManip::TemplateExists<Comps...>
+        void removeComponents(const EntityHandle &ent_)
+        {
+            (m_removedComponents[TReg::template Get<Comps>() - 1].push_back(ent_), ...);
+        }
+
+        // Appends commands from another buffer after commands of this one
+        void merge(CommandBuffer &&rhs_)
+        {
+            for (auto &el : rhs_.m_createQueues)
+            {
+                auto fnd = m_createIds.find(el->getType());
+                if (fnd == m_createIds.end())
+                {
+                    m_createIds[el->getType()] = m_createQueues.size();
+                    m_createQueues.push_back(std::move(el));
+                }
+                else
+                    m_createQueues[fnd->second]->merge(*el);
+            }
+
+            for (size_t i = 0; i < TReg::MaxID; ++i)
+            {
+                if (!rhs_.m_addQueues[i])
+                    continue;
+
+                if (m_addQueues[i])
+                    m_addQueues[i]->merge(*rhs_.m_addQueues[i]);
+                else
+                    m_addQueues[i] = std::move(rhs_.m_addQueues[i]);
+            }
+
+            for (size_t i = 0; i < TReg::MaxID; ++i)
+                m_removedComponents[i].insert(m_removedComponents[i].end(), rhs_.m_removedComponents[i].begin(), rhs_.m_removedComponents[i].end());
+
+            m_removedEntities.insert(m_removedEntities.end(), rhs_.m_removedEntities.begin(), rhs_.m_removedEntities.end());
+
+            rhs_.clear();
+        }
+
+        // Applies all recorded commands to the registry and clears the buffer
+        void apply(Registry<TReg> &reg_)
+        {
+            for (auto &el : m_createQueues)
+                el->apply(reg_);
+
+            for (auto &el : m_addQueues)
+            {
+                if (el)
+                    el->apply(reg_);
+            }
+
+            applyComponentRemovals<1>(reg_);
+
+            forEachGroup(reg_, m_removedEntities, [&reg_](size_t archId_, const std::vector<EntityHandle> &entities_)
+            {
+                auto rows = getRows(reg_, entities_);
+                reg_.removeEntitiesBatch(archId_, std::span<const size_t>(rows));
+            });
+
+            clear();
+        }
+
+        void clear()
+        {
+            m_createQueues.clear();
+            m_createIds.clear();
+
+            for (auto &el : m_addQueues)
+                el.reset();
+
+            for (auto &el : m_removedComponents)
+                el.clear();
+
+            m_removedEntities.clear();
+        }
+
+        bool empty() const
+        {
+            if (!m_createQueues.empty() || !m_removedEntities.empty())
+                return false;
+
+            for (size_t i = 0; i < TReg::MaxID; ++i)
+            {
+                if (m_addQueues[i] || !m_removedComponents[i].empty())
+                    return false;
+            }
+
+            return true;
+        }
+
+    private:
+        class Queue
+        {
+        public:
+            virtual void apply(Registry<TReg> &reg_) = 0;
+            virtual void merge(Queue &rhs_) = 0;
+            virtual std::type_index getType() const = 0;
+            virtual ~Queue() = default;
+        };
+
+        template<typename Signature, typename... Emplaced>
+        class CreateQueue;
+
+        // Creations of entities with the same signature, applied as a single createEntities call
+        template<typename... Comps, typename... Emplaced>
+        class CreateQueue<TypeManip::Typelist<Comps...>, Emplaced...> : public Queue
+        {
+        public:
+            virtual void apply(Registry<TReg> &reg_) override
+            {
+                applyImpl(reg_, std::index_sequence_for<Emplaced...>());
+            }
+
+            virtual void merge(Queue &rhs_) override
+            {
+                auto &rhs = static_cast<CreateQueue&>(rhs_);
+                m_components.reserve(m_components.size() + rhs.m_components.size());
+                std::move(rhs.m_components.begin(), rhs.m_components.end(), std::back_inserter(m_components));
+            }
+
+            virtual std::type_index getType() const override
+            {
+                return typeid(CreateQueue);
+            }
+
+            std::vector<std::tuple<Emplaced...>> m_components;
+
+        private:
+            template<size_t... Is>
+            void applyImpl(Registry<TReg> &reg_, std::index_sequence<Is...>)
+            {
+                reg_.template createEntities<Comps...>(m_components.size(), [this](size_t id_) -> Emplaced&&
+                {
+                    return std::move(std::get<Is>(m_components[id_]));
+                }...);
+            }
+        };
+
+        // Emplaced components of a single type, grouped by archetype and applied as batches
+        template<typename T>
+        class AddQueue : public Queue
+        {
+        public:
+            virtual void apply(Registry<TReg> &reg_) override
+            {
+                forEachGroup(reg_, m_entities, [&](size_t archId_, const std::vector<EntityHandle> &entities_, const std::vector<size_t> &order_)
+                {
+                    auto rows = getRows(reg_, entities_);
+                    reg_.emplaceComponentsBatch(archId_, std::span<const size_t>(rows), [&](size_t id_) -> T&&
+                    {
+                        return std::move(m_components[order_[id_]]);
+                    });
+                });
+            }
+
+            virtual void merge(Queue &rhs_) override
+            {
+                auto &rhs = static_cast<AddQueue&>(rhs_);
+                m_entities.insert(m_entities.end(), rhs.m_entities.begin(), rhs.m_entities.end());
+                m_components.reserve(m_components.size() + rhs.m_components.size());
+                std::move(rhs.m_components.begin(), rhs.m_components.end(), std::back_inserter(m_components));
+            }
+
+            virtual std::type_index getType() const override
+            {
+                return typeid(AddQueue);
+            }
+
+            std::vector<EntityHandle> m_entities;
+            std::vector<T> m_components;
+        };
+
+        template<typename Queue_t>
+        Queue_t &getCreateQueue()
+        {
+            auto fnd = m_createIds.find(typeid(Queue_t));
+            if (fnd != m_createIds.end())
+                return static_cast<Queue_t&>(*m_createQueues[fnd->second]);
+
+            m_createIds[typeid(Queue_t)] = m_createQueues.size();
+            m_createQueues.push_back(std::make_unique<Queue_t>());
+            return static_cast<Queue_t&>(*m_createQueues.back());
+        }
+
+        template<typename T>
+        AddQueue<T> &getAddQueue()
+        {
+            auto &queue = m_addQueues[TReg::template Get<T>() - 1];
+            if (!queue)
+                queue = std::make_unique<AddQueue<T>>();
+
+            return static_cast<AddQueue<T>&>(*queue);
+        }
+
+        template<int CurrentType>
+        void applyComponentRemovals(Registry<TReg> &reg_)
+        {
+            forEachGroup(reg_, m_removedComponents[CurrentType - 1], [&reg_](size_t archId_, const std::vector<EntityHandle> &entities_)
+            {
+                auto rows = getRows(reg_, entities_);
+                reg_.template removeComponentsBatch<typename TReg::template GetById<CurrentType>>(archId_, std::span<const size_t>(rows));
+            });
+
+            if constexpr (CurrentType < TReg::MaxID)
+                applyComponentRemovals<CurrentType + 1>(reg_);
+        }
+
+        /*
+            Splits alive entities by their current archetype, keeping only the last command for every entity
+            Groups are visited in order of first appearance, callback also receives indexes of commands in the original list if it accepts them
+        */
+        template<typename F>
+        static void forEachGroup(Registry<TReg> &reg_, const std::vector<EntityHandle> &entities_, F f_)
+        {
+            std::unordered_map<EntityId, size_t> lastCommand;
+            for (size_t i = 0; i < entities_.size(); ++i)
+            {
+                if (reg_.isAlive(entities_[i]))
+                    lastCommand[entities_[i].m_id] = i;
+            }
+
+            std::vector<size_t> groupArchetypes;
+            std::unordered_map<size_t, size_t> groupIds;
+            std::vector<std::vector<EntityHandle>> groups;
+            std::vector<std::vector<size_t>> orders;
+            for (size_t i = 0; i < entities_.size(); ++i)
+            {
+                auto fnd = lastCommand.find(entities_[i].m_id);
+                if (fnd == lastCommand.end() || fnd->second != i)
+                    continue;
+
+                auto archId = reg_.getIndex(entities_[i]).m_archetypeId;
+                auto [group, inserted] = groupIds.try_emplace(archId, groups.size());
+                if (inserted)
+                {
+                    groupArchetypes.push_back(archId);
+                    groups.emplace_back();
+                    orders.emplace_back();
+                }
+
+                groups[group->second].push_back(entities_[i]);
+                orders[group->second].push_back(i);
+            }
+
+            for (size_t i = 0; i < groups.size(); ++i)
+            {
+                if constexpr (std::invocable<F&, size_t, const std::vector<EntityHandle>&, const std::vector<size_t>&>)
+                    f_(groupArchetypes[i], groups[i], orders[i]);
+                else
+                    f_(groupArchetypes[i], groups[i]);
+            }
+        }
+
+        // Current rows of entities, resolved right before use since previous batches might have moved them
+        static std::vector<size_t> getRows(Registry<TReg> &reg_, const std::vector<EntityHandle> &entities_)
+        {
+            std::vector<size_t> rows(entities_.size());
+            for (size_t i = 0; i < entities_.size(); ++i)
+                rows[i] = reg_.getIndex(entities_[i]).m_entityId;
+
+            return rows;
+        }
+
+        std::vector<std::unique_ptr<Queue>> m_createQueues;
+        std::unordered_map<std::type_index, size_t> m_createIds;
+        std::array<std::unique_ptr<Queue>, TReg::MaxID> m_addQueues;
+        std::array<std::vector<EntityHandle>, TReg::MaxID> m_removedComponents;
+        std::vector<EntityHandle> m_removedEntities;
+    };
+}
+
+#endif
@@ -0,0 +1,200 @@
+#ifndef COMPONENT_MASK_H_
+#define COMPONENT_MASK_H_
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <bit>
+#include <ostream>
+
+namespace ECS
+{
+    /*
+        Set of component ids (id - 1) of any size, replacement for std::bitset that is usable in constant expressions
+        Stored as an array of 64 bit words, unused bits of the last word are always 0
+        Set operations walk all words without early exits, so compiler can vectorize them
+    */
+    template<size_t Bits>
+    class ComponentMask
+    {
+    public:
+        using Word = uint64_t;
+        static constexpr size_t WORD_BITS = 64;
+        static constexpr size_t WORD_COUNT = Bits > 0 ? (Bits + WORD_BITS - 1) / WORD_BITS : 1;
+
+        constexpr ComponentMask() = default;
+
+        constexpr bool operator[](size_t bit_) const
+        {
+            return (m_words[bit_ / WORD_BITS] >> (bit_ % WORD_BITS)) & 1;
+        }
+
+        constexpr ComponentMask &set(size_t bit_, bool value_ = true)
+        {
+            if (value_)
+                m_words[bit_ / WORD_BITS] |= Word(1) << (bit_ % WORD_BITS);
+            else
+                m_words[bit_ / WORD_BITS] &= ~(Word(1) << (bit_ % WORD_BITS));
+
+            return *this;
+        }
+
+        constexpr ComponentMask &reset(size_t bit_)
+        {
+            return set(bit_, false);
+        }
+
+        constexpr ComponentMask &reset()
+        {
+            m_words.fill(0);
+            return *this;
+        }
+
+        constexpr bool any() const
+        {
+            Word res = 0;
+            for (auto el : m_words)
+                res |= el;
+
+            return res != 0;
+        }
+
+        constexpr bool none() const
+        {
+            return !any();
+        }
+
+        constexpr size_t count() const
+        {
+            size_t res = 0;
+            for (auto el : m_words)
+                res += std::popcount(el);
+
+            return res;
+        }
+
+        // Every bit of rhs_ is also set in this mask
+        constexpr bool contains(const ComponentMask &rhs_) const
+        {
+            Word missing = 0;
+            for (size_t i = 0; i < WORD_COUNT; ++i)
+                missing |= rhs_.m_words[i] & ~m_words[i];
+
+            return missing == 0;
+        }
+
+        // At least one bit is set in both masks
+        constexpr bool intersects(const ComponentMask &rhs_) const
+        {
+            Word common = 0;
+            for (size_t i = 0; i < WORD_COUNT; ++i)
+                common |= rhs_.m_words[i] & m_words[i];
+
+            return common != 0;
+        }
+
+        constexpr ComponentMask &operator|=(const ComponentMask &rhs_)
+        {
+            for (size_t i = 0; i < WORD_COUNT; ++i)
+                m_words[i] |= rhs_.m_words[i];
+
+            return *this;
+        }
+
+        constexpr ComponentMask &operator&=(const ComponentMask &rhs_)
+        {
+            for (size_t i = 0; i < WORD_COUNT; ++i)
+                m_words[i] &= rhs_.m_words[i];
+
+            return *this;
+        }
+
+        constexpr ComponentMask &operator^=(const ComponentMask &rhs_)
+        {
+            for (size_t i = 0; i < WORD_COUNT; ++i)
+                m_words[i] ^= rhs_.m_words[i];
+
+            return *this;
+        }
+
+        constexpr ComponentMask operator~() const
+        {
+            ComponentMask res;
+            for (size_t i = 0; i < WORD_COUNT; ++i)
+                res.m_words[i] = ~m_words[i];
+
+            res.trim();
+            return res;
+        }
+
+        friend constexpr ComponentMask operator|(ComponentMask lhs_, const ComponentMask &rhs_)
+        {
+            return lhs_ |= rhs_;
+        }
+
+        friend constexpr ComponentMask operator&(ComponentMask lhs_, const ComponentMask &rhs_)
+        {
+            return lhs_ &= rhs_;
+        }
+
+        friend constexpr ComponentMask operator^(ComponentMask lhs_, const ComponentMask &rhs_)
+        {
+            return lhs_ ^= rhs_;
+        }
+
+        constexpr bool operator==(const ComponentMask &rhs_) const = default;
+
+        // Every bit affects low bits of the result, so it can be used with power of two tables directly
+        constexpr size_t hash() const
+        {
+            uint64_t res = 0;
+            for (auto el : m_words)
+            {
+                res ^= el;
+                res = (res ^ (res >> 30)) * 0xbf58476d1ce4e5b9ull;
+                res = (res ^ (res >> 27)) * 0x94d049bb133111ebull;
+                res ^= res >> 31;
+            }
+
+            return static_cast<size_t>(res);
+        }
+
+        struct Hash
+        {
+            size_t operator()(const ComponentMask &mask_) const
+            {
+                return mask_.hash();
+            }
+        };
+
+        // Same format as std::bitset, highest bit first
+        friend std::ostream &operator<<(std::ostream &os_, const ComponentMask &mask_)
+        {
+            for (size_t i = Bits; i-- > 0;)
+                os_ << (mask_[i] ? '1' : '0');
+
+            return os_;
+        }
+
+    private:
+        constexpr void trim()
+        {
+            if constexpr (Bits % WORD_BITS != 0)
+                m_words[WORD_COUNT - 1] &= (Word(1) << (Bits % WORD_BITS)) - 1;
+            else if constexpr (Bits == 0)
+                m_words[0] = 0;
+        }
+
+        std::array<Word, WORD_COUNT> m_words{};
+    };
+
+    // Mask of listed components of the type registry, can be used in constant expressions
+    template<typename TReg, typename... Ts>
+    constexpr ComponentMask<TReg::MaxID> makeComponentMask()
+    {
+        ComponentMask<TReg::MaxID> res;
+        (res.set(TReg::template Get<Ts>() - 1), ...);
+        return res;
+    }
+}
+
+#endif
@@ -0,0 +1,199 @@
+#include "JobSystem.h"
+#include <utility>
+
+namespace
+{
+    // Queue of the current thread if its a worker
+    thread_local const ECS::JobSystem *CurrentSystem = nullptr;
+    thread_local size_t CurrentQueue = 0;
+}
+
+bool ECS::JobGroup::isDone() const
+{
+    return m_pending.load() == 0;
+}
+
+ECS::JobSystem::JobSystem(size_t workerCount_)
+{
+    for (size_t i = 0; i < workerCount_ + 1; ++i)
+        m_queues.push_back(std::make_unique<WorkQueue>());
+
+    m_workers.reserve(workerCount_);
+    for (size_t i = 0; i < workerCount_; ++i)
+        m_workers.emplace_back(&JobSystem::workerLoop, this, i);
+}
+
+void ECS::JobSystem::submit(JobGroup &group_, std::function<void()> job_)
+{
+    ++group_.m_pending;
+
+    auto &queue = *m_queues[CurrentSystem == this ? CurrentQueue : m_workers.size()];
+    {
+        std::lock_guard lock(queue.m_mutex);
+        ++m_queued;
+        queue.m_jobs.push_back({std::move(job_), &group_});
+    }
+
+    notify(false);
+}
+
+void ECS::JobSystem::wait(JobGroup &group_)
+{
+    while (!group_.isDone())
+    {
+        if (tryRun())
+            continue;
+
+        std::unique_lock lock(m_sleepMutex);
+        m_wakeUp.wait(lock, [&]() { return group_.isDone() || m_queued.load() > 0; });
+    }
+
+    if (group_.m_exception)
+        std::rethrow_exception(std::exchange(group_.m_exception, nullptr));
+}
+
+void ECS::JobSystem::parallelFor(size_t count_, const std::function<void(size_t)> &f_)
+{
+    if (count_ == 0)
+        return;
+
+    if (count_ == 1 || m_workers.empty())
+    {
+        for (size_t i = 0; i < count_; ++i)
+            f_(i);
+
+        return;
+    }
+
+    // Indexes are handed out one by one, so long iterations don't stall the rest
+    std::atomic<size_t> next = 0;
+    std::exception_ptr exception;
+    std::mutex exceptionMutex;
+    auto loop = [&]()
+    {
+        for (size_t id = next++; id < count_; id = next++)
+        {
+            try
+            {
+                f_(id);
+            }
+            catch (...)
+            {
+                std::lock_guard lock(exceptionMutex);
+                if (!exception)
+                    exception = std::current_exception();
+            }
+        }
+    };
+
+    JobGroup group;
+    auto helpers = std::min(count_ - 1, m_workers.size());
+    for (size_t i = 0; i < helpers; ++i)
+        submit(group, loop);
+
+    loop();
+    wait(group);
+
+    if (exception)
+        std::rethrow_exception(exception);
+}
+
+size_t ECS::JobSystem::getThreadCount() const
+{
+    return m_workers.size() + 1;
+}
+
+ECS::JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard lock(m_sleepMutex);
+        m_stop = true;
+    }
+    m_wakeUp.notify_all();
+
+    for (auto &el : m_workers)
+        el.join();
+}
+
+bool ECS::JobSystem::tryRun()
+{
+    const size_t own = (CurrentSystem == this ? CurrentQueue : m_workers.size());
+    Job job;
+    bool found = false;
+
+    for (size_t i = 0; i < m_queues.size() && !found; ++i)
+    {
+        auto &queue = *m_queues[(own + i) % m_queues.size()];
+        std::lock_guard lock(queue.m_mutex);
+        if (queue.m_jobs.empty())
+            continue;
+
+        // Own queue is used as a stack to keep recently touched data hot, other queues are robbed from the oldest job
+        if (i == 0)
+        {
+            job = std::move(queue.m_jobs.back());
+            queue.m_jobs.pop_back();
+        }
+        else
+        {
+            job = std::move(queue.m_jobs.front());
+            queue.m_jobs.pop_front();
+        }
+
+        --m_queued;
+        found = true;
+    }
+
+    if (found)
+        run(job);
+
+    return found;
+}
+
+void ECS::JobSystem::run(Job &job_)
+{
+    try
+    {
+        job_.m_func();
+    }
+    catch (...)
+    {
+        std::lock_guard lock(job_.m_group->m_exceptionMutex);
+        if (!job_.m_group->m_exception)
+            job_.m_group->m_exception = std::current_exception();
+    }
+
+    // Group might be destroyed by its owner right after this
+    if (--job_.m_group->m_pending == 0)
+        notify(true);
+}
+
+void ECS::JobSystem::workerLoop(size_t queueId_)
+{
+    CurrentSystem = this;
+    CurrentQueue = queueId_;
+
+    while (true)
+    {
+        if (tryRun())
+            continue;
+
+        std::unique_lock lock(m_sleepMutex);
+        m_wakeUp.wait(lock, [&]() { return m_stop || m_queued.load() > 0; });
+
+        if (m_stop && m_queued.load() == 0)
+            return;
+    }
+}
+
+void ECS::JobSystem::notify(bool all_)
+{
+    {
+        std::lock_guard lock(m_sleepMutex);
+    }
+
+    if (all_)
+        m_wakeUp.notify_all();
+    else
+        m_wakeUp.notify_one();
+}
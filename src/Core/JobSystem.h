@@ -0,0 +1,104 @@
+#ifndef JOB_SYSTEM_H_
+#define JOB_SYSTEM_H_
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <cstddef>
+
+namespace ECS
+{
+    /*
+        Tracks completion of a number of jobs
+        Counts jobs that are submitted but not finished yet and keeps the first exception thrown by any of them
+    */
+    class JobGroup
+    {
+    public:
+        JobGroup() = default;
+
+        JobGroup(const JobGroup &rhs_) = delete;
+        JobGroup &operator=(const JobGroup &rhs_) = delete;
+
+        bool isDone() const;
+
+    private:
+        friend class JobSystem;
+
+        std::atomic<size_t> m_pending = 0;
+        std::exception_ptr m_exception;
+        std::mutex m_exceptionMutex;
+    };
+
+    /*
+        Work-stealing pool of worker threads
+        Every worker has its own queue, jobs submitted from a worker go to its queue and are taken from its back,
+        idle workers steal from the front of other queues, jobs submitted from other threads go to a shared queue
+        Threads that wait for a group run queued jobs instead of blocking, so jobs can submit and wait for other jobs
+        First exception thrown by a job of a group is rethrown by wait
+    */
+    class JobSystem
+    {
+    public:
+        // Amount of workers in addition to the calling thread, by default its one less than amount of hardware threads
+        JobSystem(size_t workerCount_ = std::max(std::thread::hardware_concurrency(), 1u) - 1);
+
+        JobSystem(const JobSystem &rhs_) = delete;
+        JobSystem &operator=(const JobSystem &rhs_) = delete;
+        JobSystem(JobSystem &&rhs_) = delete;
+        JobSystem &operator=(JobSystem &&rhs_) = delete;
+
+        void submit(JobGroup &group_, std::function<void()> job_);
+
+        // Runs queued jobs until every job of the group is finished
+        void wait(JobGroup &group_);
+
+        // Calls f_(i) for every i in [0, count_), in no particular order and possibly in parallel
+        void parallelFor(size_t count_, const std::function<void(size_t)> &f_);
+
+        // Including the calling thread
+        size_t getThreadCount() const;
+
+        ~JobSystem();
+
+    private:
+        struct Job
+        {
+            std::function<void()> m_func;
+            JobGroup *m_group = nullptr;
+        };
+
+        struct WorkQueue
+        {
+            std::deque<Job> m_jobs;
+            std::mutex m_mutex;
+        };
+
+        // Takes a job from own queue or steals one from others, returns false if every queue is empty
+        bool tryRun();
+
+        void run(Job &job_);
+
+        void workerLoop(size_t queueId_);
+
+        // Wakes up sleeping threads, lock is required so nobody misses it between checking the condition and waiting
+        void notify(bool all_);
+
+        // Last queue is shared by threads that are not workers
+        std::vector<std::unique_ptr<WorkQueue>> m_queues;
+        std::vector<std::thread> m_workers;
+        std::atomic<size_t> m_queued = 0;
+
+        std::mutex m_sleepMutex;
+        std::condition_variable m_wakeUp;
+        bool m_stop = false;
+    };
+}
+
+#endif
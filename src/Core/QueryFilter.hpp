@@ -0,0 +1,318 @@
+#ifndef QUERY_FILTER_H_
+#define QUERY_FILTER_H_
+#include "Archetype.hpp"
+#include <vector>
+#include <functional>
+
+// Maximal amount of Changed and Added terms in a query
+#ifndef YAECS_TICK_TERM_CAPACITY
+    #define YAECS_TICK_TERM_CAPACITY 4
+#endif
+
+namespace ECS
+{
+    /*
+        Filter terms for Registry::makeQuery, resolved once per archetype when it is matched
+        Plain component types in makeQuery are the same as With
+    */
+
+    // Archetype should contain all listed components
+    template<typename... Ts>
+    struct With {};
+
+    // Archetype should contain none of listed components
+    template<typename... Ts>
+    struct Without {};
+
+    // Archetype may or may not contain listed components, doesn't affect matching
+    template<typename... Ts>
+    struct Optional {};
+
+    // Archetype should contain at least one of listed components
+    template<typename... Ts>
+    struct AnyOf {};
+
+    // Archetype should contain the component, row is visited only if it was changed since the last run of the query
+    // Component should be change tracked (see IsChangeTracked)
+    template<typename T>
+    struct Changed {};
+
+    // Archetype should contain the component, row is visited only if it was added since the last run of the query
+    // Component should be change tracked (see IsChangeTracked)
+    template<typename T>
+    struct Added {};
+
+    template<typename TReg>
+    struct QueryFilter
+    {
+        static constexpr size_t TICK_TERM_CAPACITY = YAECS_TICK_TERM_CAPACITY;
+
+        // Component whose ticks are compared by a Changed or Added term
+        struct TickTerm
+        {
+            int m_id;
+            bool m_added;
+
+            bool operator==(const TickTerm &rhs_) const = default;
+        };
+
+        ComponentMask<TReg::MaxID> m_with;
+        ComponentMask<TReg::MaxID> m_without;
+        std::vector<ComponentMask<TReg::MaxID>> m_anyOf;
+        ComponentMask<TReg::MaxID> m_changed;
+        ComponentMask<TReg::MaxID> m_added;
+        std::vector<TickTerm> m_tickTerms; // Collected from changed and added masks once, so rows are only checked against them
+
+        bool matches(const ComponentMask<TReg::MaxID> &mask_) const
+        {
+            if (!mask_.contains(m_with) || mask_.intersects(m_without))
+                return false;
+
+            for (const auto &el : m_anyOf)
+            {
+                if (!mask_.intersects(el))
+                    return false;
+            }
+
+            return true;
+        }
+
+        bool operator==(const QueryFilter &rhs_) const = default;
+
+        template<typename... Terms>
+        static QueryFilter make()
+        {
+            static_assert((countTickTerms(static_cast<Terms*>(nullptr)) + ... + 0) <= TICK_TERM_CAPACITY,
+                "Too many Changed and Added terms in a query, increase YAECS_TICK_TERM_CAPACITY");
+
+            QueryFilter res;
+            (addTerm(res, static_cast<Terms*>(nullptr)), ...);
+
+            for (int id = 1; id <= TReg::MaxID; ++id)
+            {
+                if (res.m_changed[id - 1])
+                    res.m_tickTerms.push_back({id, false});
+
+                if (res.m_added[id - 1])
+                    res.m_tickTerms.push_back({id, true});
+            }
+
+            return res;
+        }
+
+        struct Hash
+        {
+            size_t operator()(const QueryFilter &filter_) const
+            {
+                auto res = filter_.m_with.hash() ^ (filter_.m_without.hash() * 31) ^ (filter_.m_changed.hash() * 131) ^ (filter_.m_added.hash() * 1031);
+                for (const auto &el : filter_.m_anyOf)
+                    res = res * 31 + el.hash();
+
+                return res;
+            }
+        };
+
+    private:
+        template<typename... Ts>
+        static constexpr ComponentMask<TReg::MaxID> makeMask()
+        {
+            return makeComponentMask<TReg, Ts...>();
+        }
+
+        template<typename T>
+        static constexpr size_t countTickTerms(T*)
+        {
+            return 0;
+        }
+
+        template<typename T>
+        static constexpr size_t countTickTerms(Changed<T>*)
+        {
+            return 1;
+        }
+
+        template<typename T>
+        static constexpr size_t countTickTerms(Added<T>*)
+        {
+            return 1;
+        }
+
+        template<typename T>
+        static void addTerm(QueryFilter &filter_, T*)
+        {
+            filter_.m_with |= makeMask<T>();
+        }
+
+        template<typename... Ts>
+        static void addTerm(QueryFilter &filter_, With<Ts...>*)
+        {
+            filter_.m_with |= makeMask<Ts...>();
+        }
+
+        template<typename... Ts>
+        static void addTerm(QueryFilter &filter_, Without<Ts...>*)
+        {
+            filter_.m_without |= makeMask<Ts...>();
+        }
+
+        template<typename... Ts>
+        static void addTerm(QueryFilter &, Optional<Ts...>*)
+        {
+        }
+
+        template<typename... Ts>
+        static void addTerm(QueryFilter &filter_, AnyOf<Ts...>*)
+        {
+            filter_.m_anyOf.push_back(makeMask<Ts...>());
+        }
+
+        template<typename T>
+        static void addTerm(QueryFilter &filter_, Changed<T>*)
+        {
+            static_assert(IS_CHANGE_TRACKED<T>, "Changed term requires IsChangeTracked to be specialized for the component");
+            filter_.m_with |= makeMask<T>();
+            filter_.m_changed |= makeMask<T>();
+        }
+
+        template<typename T>
+        static void addTerm(QueryFilter &filter_, Added<T>*)
+        {
+            static_assert(IS_CHANGE_TRACKED<T>, "Added term requires IsChangeTracked to be specialized for the component");
+            filter_.m_with |= makeMask<T>();
+            filter_.m_added |= makeMask<T>();
+        }
+    };
+
+    /*
+        Rows of a single archetype that pass Changed and Added terms of a filter
+        Resolved the same way as QueryColumn, indexes are relative to the first row, empty if filter has no such terms
+        Only walks terms collected by the filter and keeps their tick pointers inline, so resolving it for every chunk is cheap and never allocates
+    */
+    template<typename TReg>
+    class RowFilter
+    {
+    public:
+        RowFilter(Archetype<TReg> &arch_, const QueryFilter<TReg> &filter_, Tick since_, size_t first_ = 0) :
+            m_since(since_)
+        {
+            for (const auto &el : filter_.m_tickTerms)
+                m_ticks[m_size++] = el.m_added ? arch_.getAddedTicks(el.m_id, first_) : arch_.getChangedTicks(el.m_id, first_);
+        }
+
+        inline bool passes(size_t id_) const
+        {
+            for (size_t i = 0; i < m_size; ++i)
+            {
+                if (m_ticks[i][id_] <= m_since)
+                    return false;
+            }
+
+            return true;
+        }
+
+        inline bool empty() const
+        {
+            return m_size == 0;
+        }
+
+    private:
+        std::array<const Tick*, QueryFilter<TReg>::TICK_TERM_CAPACITY> m_ticks;
+        size_t m_size = 0;
+        Tick m_since;
+    };
+
+    /*
+        Column of a required component within an archetype, passed to query callbacks as reference
+        Resolved once per archetype or once per chunk if archetype uses them, indexes are relative to the first row
+        Queries mark visited rows of non-const change tracked columns as changed with the tick of the current run (see markChanged),
+        so access itself is a plain load, const columns are never marked
+    */
+    template<typename TReg, typename T>
+    struct QueryColumn
+    {
+        using Component = std::remove_const_t<T>;
+        static constexpr bool MARKS_CHANGES = !std::is_const_v<T> && IS_CHANGE_TRACKED<Component>;
+
+        QueryColumn() = default;
+
+        QueryColumn(Archetype<TReg> &arch_, Tick tick_, size_t first_ = 0) :
+            m_data(arch_.template getColumn<Component>(first_)),
+            m_changed(MARKS_CHANGES ? arch_.getChangedTicks(TReg::template Get<Component>(), first_) : nullptr),
+            m_tick(tick_)
+        {
+        }
+
+        static bool isPresent(const Archetype<TReg> &arch_)
+        {
+            return arch_.template containsComponents<Component>();
+        }
+
+        inline T &operator[](size_t id_) const
+        {
+            return m_data[id_];
+        }
+
+        // Called by queries once per run of visited rows, instead of a store on every access
+        inline void markChanged(size_t id_, size_t count_ = 1) const
+        {
+            if constexpr (MARKS_CHANGES)
+                std::fill_n(m_changed + id_, count_, m_tick);
+        }
+
+        Component *m_data = nullptr;
+        Tick *m_changed = nullptr;
+        Tick m_tick = 0;
+    };
+
+    /*
+        Column of an optional component, passed to query callbacks as pointer which is nullptr if archetype doesn't have it
+        Missing column has zero stride, so there is no branch per entity
+    */
+    template<typename TReg, typename T>
+    struct QueryColumn<TReg, Optional<T>>
+    {
+        using Component = std::remove_const_t<T>;
+        static constexpr bool MARKS_CHANGES = !std::is_const_v<T> && IS_CHANGE_TRACKED<Component>;
+
+        QueryColumn() = default;
+
+        QueryColumn(Archetype<TReg> &arch_, Tick tick_, size_t first_ = 0) :
+            m_tick(tick_)
+        {
+            if (arch_.template containsComponents<Component>())
+            {
+                m_data = arch_.template getColumn<Component>(first_);
+                if constexpr (MARKS_CHANGES)
+                    m_changed = arch_.getChangedTicks(TReg::template Get<Component>(), first_);
+
+                m_stride = 1;
+            }
+        }
+
+        static bool isPresent(const Archetype<TReg> &)
+        {
+            return true;
+        }
+
+        inline T *operator[](size_t id_) const
+        {
+            return m_data + id_ * m_stride;
+        }
+
+        inline void markChanged(size_t id_, size_t count_ = 1) const
+        {
+            if constexpr (MARKS_CHANGES)
+            {
+                if (m_stride)
+                    std::fill_n(m_changed + id_, count_, m_tick);
+            }
+        }
+
+        Component *m_data = nullptr;
+        Tick *m_changed = nullptr;
+        size_t m_stride = 0;
+        Tick m_tick = 0;
+    };
+}
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+#include "TypeManip.hpp"
+#include "JobSystem.h"
+#include "ComponentMask.hpp"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace ECS
+{
+    // System that declares components it reads and writes as Typelists and has update()
+    template<typename System>
+    concept ScheduledSystem = requires(System &sys_)
+    {
+        typename System::Reads;
+        typename System::Writes;
+        sys_.update();
+    };
+
+    struct SystemTiming
+    {
+        std::string m_name;
+        std::chrono::nanoseconds m_last{0};
+        std::chrono::nanoseconds m_total{0};
+        size_t m_runs = 0;
+    };
+
+    /*
+        Runs systems once per frame on a job system, respecting their declared component access
+        Two systems conflict if one of them writes a component the other one reads or writes,
+        or if any of them is exclusive (for example, adds or removes entities)
+        Conflicting systems run in registration order, the rest run concurrently
+        Access is only checked at compile time through declarations, systems have to be honest about it
+    */
+    template<typename TReg>
+    class Scheduler
+    {
+    public:
+        Scheduler(JobSystem &jobs_) :
+            m_jobs(jobs_)
+        {
+        }
+
+        template<typename Reads, typename Writes, bool Exclusive = false>
+        size_t addSystem(std::string name_, std::function<void()> update_)
+        {
+            Node node;
+            node.m_reads = makeMask(static_cast<Reads*>(nullptr));
+            node.m_writes = makeMask(static_cast<Writes*>(nullptr));
+            node.m_exclusive = Exclusive;
+            node.m_update = std::move(update_);
+
+            auto id = m_nodes.size();
+            for (size_t i = 0; i < id; ++i)
+            {
+                if (conflicts(m_nodes[i], node))
+                {
+                    m_nodes[i].m_dependents.push_back(id);
+                    node.m_dependencies++;
+                }
+            }
+
+            m_nodes.push_back(std::move(node));
+            m_timings.push_back({std::move(name_)});
+            return id;
+        }
+
+        // System is expected to outlive the scheduler, it may declare itself exclusive with static constexpr bool Exclusive
+        template<ScheduledSystem System>
+        size_t addSystem(System &system_, std::string name_)
+        {
+            constexpr bool exclusive = [] {
+                if constexpr (requires { System::Exclusive; })
+                    return static_cast<bool>(System::Exclusive);
+                else
+                    return false;
+            } ();
+
+            return addSystem<typename System::Reads, typename System::Writes, exclusive>(std::move(name_), [&system_]() { system_.update(); });
+        }
+
+        // Runs every system once, returns after all of them are finished, if a system throws, its dependents are skipped
+        void run()
+        {
+            m_remaining = std::vector<std::atomic<size_t>>(m_nodes.size());
+            for (size_t i = 0; i < m_nodes.size(); ++i)
+                m_remaining[i] = m_nodes[i].m_dependencies;
+
+            JobGroup group;
+            for (size_t i = 0; i < m_nodes.size(); ++i)
+            {
+                if (m_nodes[i].m_dependencies == 0)
+                    submitNode(group, i);
+            }
+
+            m_jobs.wait(group);
+        }
+
+        const std::vector<SystemTiming> &getTimings() const
+        {
+            return m_timings;
+        }
+
+        void resetTimings()
+        {
+            for (auto &el : m_timings)
+            {
+                el.m_last = el.m_total = std::chrono::nanoseconds{0};
+                el.m_runs = 0;
+            }
+        }
+
+        void dumpTimings(std::ostream &os_) const
+        {
+            for (const auto &el : m_timings)
+            {
+                os_ << el.m_name << ": last " << el.m_last.count() / 1000.0f << " us, avg "
+                    << (el.m_runs ? el.m_total.count() / 1000.0f / el.m_runs : 0.0f) << " us over " << el.m_runs << " runs\n";
+            }
+        }
+
+        void dumpGraph(std::ostream &os_) const
+        {
+            for (size_t i = 0; i < m_nodes.size(); ++i)
+            {
+                os_ << m_timings[i].m_name << " (R " << m_nodes[i].m_reads << ", W " << m_nodes[i].m_writes << ") ->";
+                for (auto dep : m_nodes[i].m_dependents)
+                    os_ << " " << m_timings[dep].m_name;
+
+                os_ << "\n";
+            }
+        }
+
+    private:
+        struct Node
+        {
+            ComponentMask<TReg::MaxID> m_reads;
+            ComponentMask<TReg::MaxID> m_writes;
+            bool m_exclusive = false;
+            std::function<void()> m_update;
+            std::vector<size_t> m_dependents;
+            size_t m_dependencies = 0;
+        };
+
+        template<typename... Ts>
+        static constexpr ComponentMask<TReg::MaxID> makeMask(TypeManip::Typelist<Ts...>*)
+        {
+            return makeComponentMask<TReg, Ts...>();
+        }
+
+        static bool conflicts(const Node &lhs_, const Node &rhs_)
+        {
+            return lhs_.m_exclusive || rhs_.m_exclusive
+                || lhs_.m_writes.intersects(rhs_.m_reads | rhs_.m_writes)
+                || rhs_.m_writes.intersects(lhs_.m_reads);
+        }
+
+        // Dependents are submitted by the job that finished the last of their dependencies
+        void submitNode(JobGroup &group_, size_t id_)
+        {
+            m_jobs.submit(group_, [this, &group_, id_]()
+            {
+                auto &node = m_nodes[id_];
+                auto begin = std::chrono::steady_clock::now();
+                node.m_update();
+                auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin);
+
+                auto &timing = m_timings[id_];
+                timing.m_last = elapsed;
+                timing.m_total += elapsed;
+                timing.m_runs++;
+
+                for (auto dep : node.m_dependents)
+                {
+                    if (--m_remaining[dep] == 0)
+                        submitNode(group_, dep);
+                }
+            });
+        }
+
+        JobSystem &m_jobs;
+        std::vector<Node> m_nodes;
+        std::vector<SystemTiming> m_timings;
+        std::vector<std::atomic<size_t>> m_remaining;
+    };
+}
+
+#endif
@@ -3,53 +3,161 @@
 
 #include <iostream>
 #include <array>
-#include <chrono>
+#include <cstdint>
+#include <bit>
+#include <exception>
+#include <initializer_list>
 
 using StateHolder_t = uint64_t;
 constexpr inline int STATE_HOLDER_SIZE = sizeof(StateHolder_t) * 8;
 
-// Hold count_ bool values set to false by default
-// For some reason works notably faster than just a regular std::vector<bool> with compiler optimization
-// which should do the same thing under the hood
-class StateMarker
+// Amount of states that can be marked in StateMarker, states of bigger enums can't be used by GenericState
+constexpr inline size_t MAX_STATE_MARKS = STATE_HOLDER_SIZE;
+
+// Amount of states in an enum, expects enum to end with NONE, can be specialized for other enums
+template<typename ENUM_TYPE>
+struct StateEnumSize
+{
+    static constexpr size_t value = static_cast<size_t>(ENUM_TYPE::NONE);
+};
+
+/*
+    Holds Bits bool values set to false by default in an inline array of words
+    Can be constructed and used in constant expressions, marks outside of Bits are errors
+    Set operations work on whole words and keep unused bits of the last word cleared
+*/
+template<size_t Bits>
+class BasicStateMarker
 {
 public:
+    static constexpr size_t WORD_COUNT = Bits > 0 ? (Bits + STATE_HOLDER_SIZE - 1) / STATE_HOLDER_SIZE : 1;
+
+    constexpr BasicStateMarker() = default;
+
     template<typename ENUM_TYPE>
-    inline StateMarker(ENUM_TYPE lastElemP1_, const std::vector<ENUM_TYPE> &trueFields_)  :
-        m_stateMarks(static_cast<int>(lastElemP1_) / STATE_HOLDER_SIZE + 1 , 0)
+    constexpr BasicStateMarker(ENUM_TYPE lastElemP1_, std::initializer_list<ENUM_TYPE> trueFields_)
     {
+        if (static_cast<size_t>(lastElemP1_) > Bits)
+            throw std::exception();
+
         for (const auto &el: trueFields_)
-        {
-            auto casted = static_cast<int>(el);
-            auto arrid = casted / STATE_HOLDER_SIZE;
-            auto bitid = casted % STATE_HOLDER_SIZE;
-            m_stateMarks[arrid] = m_stateMarks[arrid] | ((StateHolder_t)1 << bitid);
-        }
+            set(el);
+    }
+
+    // Smaller markers can be converted to bigger ones, for example from EnumStateMarker to StateMarker
+    template<size_t OtherBits>
+    constexpr BasicStateMarker(const BasicStateMarker<OtherBits> &rhs_)
+    {
+        static_assert(OtherBits <= Bits, "Cannot fit marker into smaller one");
+
+        for (size_t i = 0; i < rhs_.WORD_COUNT; ++i)
+            m_stateMarks[i] = rhs_.getWord(i);
     }
 
     template<typename ENUM_TYPE>
-    inline void toggleMark(ENUM_TYPE id_)
+    constexpr void set(ENUM_TYPE id_)
     {
-        auto casted = static_cast<int>(id_);
-        auto arrid = casted / STATE_HOLDER_SIZE;
-        auto bitid = casted % STATE_HOLDER_SIZE;
-        m_stateMarks[arrid] = m_stateMarks[arrid] ^ ((StateHolder_t)1 << bitid);
+        auto casted = checkedId(id_);
+        m_stateMarks[casted / STATE_HOLDER_SIZE] |= (StateHolder_t)1 << (casted % STATE_HOLDER_SIZE);
     }
 
     template<typename ENUM_TYPE>
-    inline bool operator[](const ENUM_TYPE &id_) const
+    constexpr void toggleMark(ENUM_TYPE id_)
+    {
+        auto casted = checkedId(id_);
+        m_stateMarks[casted / STATE_HOLDER_SIZE] ^= (StateHolder_t)1 << (casted % STATE_HOLDER_SIZE);
+    }
+
+    template<typename ENUM_TYPE>
+    constexpr bool operator[](const ENUM_TYPE &id_) const
+    {
+        auto casted = checkedId(id_);
+        return (m_stateMarks[casted / STATE_HOLDER_SIZE] >> (casted % STATE_HOLDER_SIZE)) & (StateHolder_t)1;
+    }
+
+    constexpr StateHolder_t getWord(size_t id_) const
+    {
+        return m_stateMarks[id_];
+    }
+
+    constexpr BasicStateMarker &operator|=(const BasicStateMarker &rhs_)
+    {
+        for (size_t i = 0; i < WORD_COUNT; ++i)
+            m_stateMarks[i] |= rhs_.m_stateMarks[i];
+
+        trim();
+        return *this;
+    }
+
+    constexpr BasicStateMarker &operator&=(const BasicStateMarker &rhs_)
+    {
+        for (size_t i = 0; i < WORD_COUNT; ++i)
+            m_stateMarks[i] &= rhs_.m_stateMarks[i];
+
+        trim();
+        return *this;
+    }
+
+    friend constexpr BasicStateMarker operator|(BasicStateMarker lhs_, const BasicStateMarker &rhs_)
+    {
+        return lhs_ |= rhs_;
+    }
+
+    friend constexpr BasicStateMarker operator&(BasicStateMarker lhs_, const BasicStateMarker &rhs_)
+    {
+        return lhs_ &= rhs_;
+    }
+
+    constexpr bool operator==(const BasicStateMarker &rhs_) const = default;
+
+    constexpr bool any() const
+    {
+        StateHolder_t res = 0;
+        for (auto el : m_stateMarks)
+            res |= el;
+
+        return res != 0;
+    }
+
+    // Lowest marked id, Bits if nothing is marked
+    constexpr size_t firstSet() const
     {
-        auto casted = static_cast<int>(id_);
+        for (size_t i = 0; i < WORD_COUNT; ++i)
+        {
+            if (m_stateMarks[i])
+                return i * STATE_HOLDER_SIZE + std::countr_zero(m_stateMarks[i]);
+        }
 
-        auto arrid = casted / STATE_HOLDER_SIZE;
-        auto bitid = casted % STATE_HOLDER_SIZE;
-        return ((m_stateMarks[arrid] >> bitid) & (StateHolder_t)1);
+        return Bits;
     }
 
 private:
-    std::vector<StateHolder_t> m_stateMarks;
+    constexpr void trim()
+    {
+        if constexpr (Bits % STATE_HOLDER_SIZE != 0)
+            m_stateMarks[WORD_COUNT - 1] &= ((StateHolder_t)1 << (Bits % STATE_HOLDER_SIZE)) - 1;
+        else if constexpr (Bits == 0)
+            m_stateMarks[0] = 0;
+    }
+
+    template<typename ENUM_TYPE>
+    static constexpr size_t checkedId(ENUM_TYPE id_)
+    {
+        auto casted = static_cast<size_t>(id_);
+        if (casted >= Bits)
+            throw std::exception();
+
+        return casted;
+    }
+
+    std::array<StateHolder_t, WORD_COUNT> m_stateMarks{};
 };
 
+// Marker sized exactly for states of the enum, states are constructed from it
+template<typename ENUM_TYPE>
+using EnumStateMarker = BasicStateMarker<StateEnumSize<ENUM_TYPE>::value>;
 
+// Marker with fixed capacity, so states of any enum can keep it without templates
+using StateMarker = BasicStateMarker<MAX_STATE_MARKS>;
 
-#endif
\ No newline at end of file
+#endif
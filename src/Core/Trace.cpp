@@ -0,0 +1,132 @@
+#include "Trace.h"
+
+namespace
+{
+    ECS::Trace::Level CurrentLevel = static_cast<ECS::Trace::Level>(YAECS_TRACE_LEVEL);
+    uint32_t CurrentCategories = static_cast<uint32_t>(ECS::Trace::Category::ALL);
+    ECS::Trace::Sink *CurrentSink = nullptr;
+
+    ECS::Trace::StreamSink &getDefaultSink()
+    {
+        static ECS::Trace::StreamSink sink(std::clog);
+        return sink;
+    }
+}
+
+void ECS::Trace::Sink::flush()
+{
+}
+
+ECS::Trace::StreamSink::StreamSink(std::ostream &os_) :
+    m_os(os_)
+{
+}
+
+void ECS::Trace::StreamSink::write(Level level_, Category category_, const std::string &message_)
+{
+    m_os << "[" << getLevelName(level_) << "][" << getCategoryName(category_) << "] " << message_ << '\n';
+}
+
+void ECS::Trace::StreamSink::flush()
+{
+    m_os.flush();
+}
+
+ECS::Trace::BufferedSink::BufferedSink(std::ostream &os_, size_t limit_) :
+    m_os(os_),
+    m_limit(limit_)
+{
+    m_buffer.reserve(m_limit);
+}
+
+void ECS::Trace::BufferedSink::write(Level level_, Category category_, const std::string &message_)
+{
+    m_buffer.append("[").append(getLevelName(level_)).append("][").append(getCategoryName(category_)).append("] ").append(message_).append("\n");
+
+    if (m_buffer.size() >= m_limit)
+        flush();
+}
+
+void ECS::Trace::BufferedSink::flush()
+{
+    if (m_buffer.empty())
+        return;
+
+    m_os.write(m_buffer.data(), m_buffer.size());
+    m_os.flush();
+    m_buffer.clear();
+}
+
+ECS::Trace::BufferedSink::~BufferedSink()
+{
+    flush();
+}
+
+void ECS::Trace::setLevel(Level level_)
+{
+    CurrentLevel = level_;
+}
+
+void ECS::Trace::setCategories(uint32_t categories_)
+{
+    CurrentCategories = categories_;
+}
+
+void ECS::Trace::setSink(Sink *sink_)
+{
+    CurrentSink = sink_;
+}
+
+ECS::Trace::Sink &ECS::Trace::getSink()
+{
+    return (CurrentSink ? *CurrentSink : getDefaultSink());
+}
+
+bool ECS::Trace::isEnabled(Level level_, Category category_)
+{
+    return static_cast<int>(level_) <= static_cast<int>(CurrentLevel) && (CurrentCategories & static_cast<uint32_t>(category_));
+}
+
+void ECS::Trace::write(Level level_, Category category_, const std::string &message_)
+{
+    getSink().write(level_, category_, message_);
+}
+
+const char *ECS::Trace::getLevelName(Level level_)
+{
+    switch (level_)
+    {
+        case Level::WARNING:
+            return "WARNING";
+
+        case Level::INFO:
+            return "INFO";
+
+        case Level::VERBOSE:
+            return "VERBOSE";
+
+        default:
+            return "NONE";
+    }
+}
+
+const char *ECS::Trace::getCategoryName(Category category_)
+{
+    switch (category_)
+    {
+        case Category::REGISTRY:
+            return "REGISTRY";
+
+        case Category::ARCHETYPE:
+            return "ARCHETYPE";
+
+        case Category::QUERY:
+            return "QUERY";
+
+        case Category::CONTAINER:
+            return "CONTAINER";
+
+        default:
+            return "ALL";
+    }
+}
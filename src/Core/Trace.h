@@ -0,0 +1,120 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+/*
+    Diagnostics for the ECS core
+    YAECS_TRACE_LEVEL defines the highest level that is compiled in at all, everything above it is removed along with its arguments
+    By default its 0 (nothing) for builds with NDEBUG and WARNING for the rest
+    Compiled in messages are additionally filtered at runtime by level and category and written to a replaceable sink
+*/
+
+#define YAECS_TRACE_LEVEL_NONE 0
+#define YAECS_TRACE_LEVEL_WARNING 1
+#define YAECS_TRACE_LEVEL_INFO 2
+#define YAECS_TRACE_LEVEL_VERBOSE 3
+
+#ifndef YAECS_TRACE_LEVEL
+    #ifdef NDEBUG
+        #define YAECS_TRACE_LEVEL YAECS_TRACE_LEVEL_NONE
+    #else
+        #define YAECS_TRACE_LEVEL YAECS_TRACE_LEVEL_WARNING
+    #endif
+#endif
+
+namespace ECS::Trace
+{
+    enum class Level : int
+    {
+        NONE = YAECS_TRACE_LEVEL_NONE,
+        WARNING = YAECS_TRACE_LEVEL_WARNING,
+        INFO = YAECS_TRACE_LEVEL_INFO,
+        VERBOSE = YAECS_TRACE_LEVEL_VERBOSE
+    };
+
+    enum class Category : uint32_t
+    {
+        REGISTRY = 1 << 0,
+        ARCHETYPE = 1 << 1,
+        QUERY = 1 << 2,
+        CONTAINER = 1 << 3,
+        ALL = 0xffffffff
+    };
+
+    // Receives every message that passed the filter, message doesn't contain trailing newline
+    class Sink
+    {
+    public:
+        virtual void write(Level level_, Category category_, const std::string &message_) = 0;
+        virtual void flush();
+        virtual ~Sink() = default;
+    };
+
+    // Writes messages to the stream right away, without flushing it
+    class StreamSink : public Sink
+    {
+    public:
+        StreamSink(std::ostream &os_);
+
+        virtual void write(Level level_, Category category_, const std::string &message_) override;
+        virtual void flush() override;
+
+    private:
+        std::ostream &m_os;
+    };
+
+    // Collects messages in memory and writes them to the stream as a single block on flush or when buffer exceeds limit
+    class BufferedSink : public Sink
+    {
+    public:
+        BufferedSink(std::ostream &os_, size_t limit_ = 64 * 1024);
+
+        virtual void write(Level level_, Category category_, const std::string &message_) override;
+        virtual void flush() override;
+        virtual ~BufferedSink();
+
+    private:
+        std::ostream &m_os;
+        std::string m_buffer;
+        size_t m_limit;
+    };
+
+    void setLevel(Level level_);
+    void setCategories(uint32_t categories_);
+    // nullptr restores default sink, that writes to std::clog
+    void setSink(Sink *sink_);
+    Sink &getSink();
+
+    bool isEnabled(Level level_, Category category_);
+    void write(Level level_, Category category_, const std::string &message_);
+
+    const char *getLevelName(Level level_);
+    const char *getCategoryName(Category category_);
+}
+
+#if YAECS_TRACE_LEVEL > YAECS_TRACE_LEVEL_NONE
+    /*
+        Usage: ECS_TRACE(INFO, REGISTRY, "Created archetype " << mask);
+        Message is only formatted if it passes the runtime filter
+    */
+    #define ECS_TRACE(level_, category_, message_) \
+        do \
+        { \
+            if constexpr (static_cast<int>(ECS::Trace::Level::level_) <= YAECS_TRACE_LEVEL) \
+            { \
+                if (ECS::Trace::isEnabled(ECS::Trace::Level::level_, ECS::Trace::Category::category_)) \
+                { \
+                    std::ostringstream ecsTraceStream; \
+                    ecsTraceStream << message_; \
+                    ECS::Trace::write(ECS::Trace::Level::level_, ECS::Trace::Category::category_, ecsTraceStream.str()); \
+                } \
+            } \
+        } while (false)
+#else
+    #define ECS_TRACE(level_, category_, message_) do {} while (false)
+#endif
+
+#endif
@@ -1,55 +1,259 @@
 #include "UntypeContainer.h"
-#include <iostream>
+#include "Trace.h"
 
 ECS::UntypeContainer::UntypeContainer(UntypeContainer &&rhs_) :
     m_data(rhs_.m_data),
+    m_storage(rhs_.m_storage),
+    m_dataOffset(rhs_.m_dataOffset),
+    m_addedOffset(rhs_.m_addedOffset),
+    m_changedOffset(rhs_.m_changedOffset),
     m_capacity(rhs_.m_capacity),
     m_size(rhs_.m_size),
     m_entrySize(rhs_.m_entrySize),
+    m_entryAlign(rhs_.m_entryAlign),
+    m_tracked(rhs_.m_tracked),
+    m_growth(rhs_.m_growth),
+    m_addedTicks(std::move(rhs_.m_addedTicks)),
+    m_changedTicks(std::move(rhs_.m_changedTicks)),
+    m_tickSource(rhs_.m_tickSource),
     m_cleaner(rhs_.m_cleaner),
     m_callRealloc(rhs_.m_callRealloc),
-    m_callRemoveAt(rhs_.m_callRemoveAt)
+    m_callRemoveAt(rhs_.m_callRemoveAt),
+    m_callAppendFrom(rhs_.m_callAppendFrom),
+    m_callCompact(rhs_.m_callCompact),
+    m_callAppendDefault(rhs_.m_callAppendDefault),
+    m_callSetChunks(rhs_.m_callSetChunks)
 {
     rhs_.m_data = nullptr;
+    rhs_.m_storage = nullptr;
     rhs_.m_capacity = 0;
     rhs_.m_size = 0;
     rhs_.m_entrySize = 0;
+    rhs_.m_entryAlign = 0;
+    rhs_.m_tracked = false;
     rhs_.m_cleaner = nullptr;
     rhs_.m_callRealloc = nullptr;
     rhs_.m_callRemoveAt = nullptr;
+    rhs_.m_callAppendFrom = nullptr;
+    rhs_.m_callCompact = nullptr;
+    rhs_.m_callAppendDefault = nullptr;
+    rhs_.m_callSetChunks = nullptr;
 }
 
 ECS::UntypeContainer &ECS::UntypeContainer::operator=(UntypeContainer &&rhs_)
 {
+    if (m_cleaner)
+        m_cleaner(this);
+
     m_data = rhs_.m_data;
+    m_storage = rhs_.m_storage;
+    m_dataOffset = rhs_.m_dataOffset;
+    m_addedOffset = rhs_.m_addedOffset;
+    m_changedOffset = rhs_.m_changedOffset;
     m_capacity = rhs_.m_capacity;
     m_size = rhs_.m_size;
     m_entrySize = rhs_.m_entrySize;
+    m_entryAlign = rhs_.m_entryAlign;
+    m_tracked = rhs_.m_tracked;
+    m_growth = rhs_.m_growth;
+    m_addedTicks = std::move(rhs_.m_addedTicks);
+    m_changedTicks = std::move(rhs_.m_changedTicks);
+    m_tickSource = rhs_.m_tickSource;
     m_cleaner = rhs_.m_cleaner;
     m_callRealloc = rhs_.m_callRealloc;
+    m_callRemoveAt = rhs_.m_callRemoveAt;
+    m_callAppendFrom = rhs_.m_callAppendFrom;
+    m_callCompact = rhs_.m_callCompact;
+    m_callAppendDefault = rhs_.m_callAppendDefault;
+    m_callSetChunks = rhs_.m_callSetChunks;
 
     rhs_.m_data = nullptr;
+    rhs_.m_storage = nullptr;
     rhs_.m_capacity = 0;
     rhs_.m_size = 0;
     rhs_.m_entrySize = 0;
+    rhs_.m_entryAlign = 0;
+    rhs_.m_tracked = false;
     rhs_.m_cleaner = nullptr;
     rhs_.m_callRealloc = nullptr;
     rhs_.m_callRemoveAt = nullptr;
+    rhs_.m_callAppendFrom = nullptr;
+    rhs_.m_callCompact = nullptr;
+    rhs_.m_callAppendDefault = nullptr;
+    rhs_.m_callSetChunks = nullptr;
 
     return *this;
 }
 
+void ECS::ChunkStorage::setLayout(size_t rows_, size_t chunkBytes_, size_t alignment_)
+{
+    if ((rows_ & (rows_ - 1)) != 0)
+        throw std::exception();
+
+    release();
+    m_rows = rows_;
+    m_shift = rows_ ? std::countr_zero(rows_) : 0;
+    m_chunkBytes = chunkBytes_;
+    m_alignment = alignment_;
+}
+
+void ECS::ChunkStorage::grow(size_t required_)
+{
+    if (!m_rows)
+        throw std::exception();
+
+    auto chunkCount = (required_ + m_rows - 1) >> m_shift;
+    m_chunks.reserve(chunkCount);
+    while (m_chunks.size() < chunkCount)
+        m_chunks.push_back(static_cast<std::byte*>(::operator new(m_chunkBytes, std::align_val_t(m_alignment))));
+}
+
+void ECS::ChunkStorage::release()
+{
+    for (auto *el : m_chunks)
+        ::operator delete(el, std::align_val_t(m_alignment));
+
+    m_chunks.clear();
+}
+
+ECS::ChunkStorage::~ChunkStorage()
+{
+    release();
+}
+
+size_t ECS::GrowthPolicy::nextCapacity(size_t capacity_, size_t required_, size_t entrySize_) const
+{
+    size_t res = std::max<size_t>(capacity_ * m_factor, capacity_ + std::max<size_t>(m_minStep, 1));
+    res = std::max(res, required_);
+
+    if (m_pageSize > 0 && entrySize_ > 0)
+    {
+        auto bytes = (res * entrySize_ + m_pageSize - 1) / m_pageSize * m_pageSize;
+        res = bytes / entrySize_;
+    }
+
+    return res;
+}
+
 size_t ECS::UntypeContainer::size() const
 {
     return m_size;
 }
 
+size_t ECS::UntypeContainer::capacity() const
+{
+    return m_capacity;
+}
+
+size_t ECS::UntypeContainer::entrySize() const
+{
+    return m_entrySize;
+}
+
+size_t ECS::UntypeContainer::entryAlign() const
+{
+    return m_entryAlign;
+}
+
+bool ECS::UntypeContainer::tracksChanges() const
+{
+    return m_tracked;
+}
+
+void ECS::UntypeContainer::setChunks(ChunkStorage *storage_, size_t dataOffset_, size_t addedOffset_, size_t changedOffset_)
+{
+    if (m_callSetChunks)
+        m_callSetChunks(this, storage_, dataOffset_, addedOffset_, changedOffset_);
+}
+
+size_t ECS::UntypeContainer::getChunkRows() const
+{
+    return m_storage ? m_storage->getRows() : 0;
+}
+
+void ECS::UntypeContainer::setTickSource(const std::atomic<Tick> *tickSource_)
+{
+    m_tickSource = tickSource_;
+}
+
+ECS::Tick ECS::UntypeContainer::getCurrentTick() const
+{
+    return m_tickSource ? m_tickSource->load(std::memory_order_relaxed) : 0;
+}
+
+const ECS::Tick *ECS::UntypeContainer::addedTicks(size_t id_) const
+{
+    if (!m_tracked || (m_storage && id_ >= m_storage->capacity()))
+        return nullptr;
+
+    return addedTickAt(id_);
+}
+
+const ECS::Tick *ECS::UntypeContainer::changedTicks(size_t id_) const
+{
+    if (!m_tracked || (m_storage && id_ >= m_storage->capacity()))
+        return nullptr;
+
+    return changedTickAt(id_);
+}
+
+ECS::Tick *ECS::UntypeContainer::changedTicks(size_t id_)
+{
+    if (!m_tracked || (m_storage && id_ >= m_storage->capacity()))
+        return nullptr;
+
+    return changedTickAt(id_);
+}
+
+void ECS::UntypeContainer::markChanged(size_t id_, Tick tick_)
+{
+    if (m_tracked)
+        *changedTickAt(id_) = tick_;
+}
+
+void ECS::UntypeContainer::markChanged(size_t id_)
+{
+    if (m_tracked)
+        *changedTickAt(id_) = getCurrentTick();
+}
+
+void ECS::UntypeContainer::reserve(size_t capacity_)
+{
+    if (capacity_ > m_capacity && m_callRealloc)
+        m_callRealloc(this, capacity_);
+}
+
+void ECS::UntypeContainer::setGrowthPolicy(const GrowthPolicy &growth_)
+{
+    m_growth = growth_;
+}
+
 void ECS::UntypeContainer::push_back()
 {
-    if (m_size == m_capacity)
-        m_callRealloc(this, m_capacity * 1.3);
+    appendDefault(1);
+}
+
+void ECS::UntypeContainer::appendDefault(size_t count_)
+{
+    if (!m_callAppendDefault)
+        throw std::exception();
 
-    ++m_size;
+    m_callAppendDefault(this, count_);
+}
+
+void ECS::UntypeContainer::pushFrom(UntypeContainer &src_, size_t id_)
+{
+    m_callAppendFrom(this, &src_, &id_, 1);
+}
+
+void ECS::UntypeContainer::appendFrom(UntypeContainer &src_, const size_t *ids_, size_t count_)
+{
+    m_callAppendFrom(this, &src_, ids_, count_);
+}
+
+void ECS::UntypeContainer::compact(const size_t *holes_, const size_t *fillers_, size_t count_, size_t newSize_)
+{
+    m_callCompact(this, holes_, fillers_, count_, newSize_);
 }
 
 void ECS::UntypeContainer::removeAt(size_t newIdx_)
@@ -57,13 +261,96 @@ void ECS::UntypeContainer::removeAt(size_t newIdx_)
     m_callRemoveAt(this, newIdx_);
 }
 
+void ECS::UntypeContainer::growTicks(size_t first_)
+{
+    if (!m_tracked)
+        return;
+
+    if (!m_storage)
+    {
+        m_addedTicks.resize(m_size);
+        m_changedTicks.resize(m_size);
+    }
+
+    auto tick = getCurrentTick();
+    for (size_t i = first_; i < m_size; ++i)
+    {
+        *addedTickAt(i) = tick;
+        *changedTickAt(i) = tick;
+    }
+}
+
+void ECS::UntypeContainer::copyTicks(const UntypeContainer &src_, const size_t *ids_, size_t count_)
+{
+    if (!m_tracked)
+        return;
+
+    if (!m_storage)
+    {
+        m_addedTicks.resize(m_size);
+        m_changedTicks.resize(m_size);
+    }
+
+    auto first = m_size - count_;
+    for (size_t i = 0; i < count_; ++i)
+    {
+        *addedTickAt(first + i) = *src_.addedTickAt(ids_[i]);
+        *changedTickAt(first + i) = *src_.changedTickAt(ids_[i]);
+    }
+}
+
+size_t ECS::UntypeContainer::countConsecutive(const size_t *ids_, size_t max_) const
+{
+    if (m_storage)
+        max_ = std::min(max_, m_storage->getRows() - m_storage->getOffset(ids_[0]));
+
+    size_t len = 1;
+    while (len < max_ && ids_[len] == ids_[0] + len)
+        ++len;
+
+    return len;
+}
+
+void ECS::UntypeContainer::compactTicks(const size_t *holes_, const size_t *fillers_, size_t count_)
+{
+    if (!m_tracked)
+        return;
+
+    for (size_t i = 0; i < count_; ++i)
+    {
+        *addedTickAt(holes_[i]) = *addedTickAt(fillers_[i]);
+        *changedTickAt(holes_[i]) = *changedTickAt(fillers_[i]);
+    }
+
+    if (!m_storage)
+    {
+        m_addedTicks.resize(m_size);
+        m_changedTicks.resize(m_size);
+    }
+}
+
+void ECS::UntypeContainer::removeTicks(size_t id_)
+{
+    if (!m_tracked)
+        return;
+
+    *addedTickAt(id_) = *addedTickAt(m_size);
+    *changedTickAt(id_) = *changedTickAt(m_size);
+
+    if (!m_storage)
+    {
+        m_addedTicks.pop_back();
+        m_changedTicks.pop_back();
+    }
+}
+
 ECS::UntypeContainer::~UntypeContainer()
 {
-    if (m_data)
+    if (m_data || m_storage)
     {
         if (m_cleaner)
-            m_cleaner(m_data);
+            m_cleaner(this);
         else
-            std::cout << "WARNING: untype container has been destroyed with allocated data! Lost " << m_capacity << " x " << m_entrySize << " bytes, " << m_capacity * m_entrySize << " bytes total\n";
+            ECS_TRACE(WARNING, CONTAINER, "Untype container has been destroyed with allocated data! Lost " << m_capacity << " x " << m_entrySize << " bytes, " << m_capacity * m_entrySize << " bytes total");
     }
-}
\ No newline at end of file
+}
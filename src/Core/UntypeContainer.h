@@ -2,13 +2,135 @@
 #define UNTYPE_CONTAINER_H_
 #include <utility>
 #include <algorithm>
+#include <new>
+#include <memory>
+#include <exception>
+#include <type_traits>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <vector>
+#include <bit>
+#include "BatchSource.hpp"
 
 namespace ECS
 {
+    // Counter used for change detection, registry advances it every time a query starts iterating
+    // 64 bits, so it never wraps and Changed / Added filters can compare ticks directly
+    using Tick = uint64_t;
+
+    /*
+        Types that can be moved to another address by copying their bytes without calling constructor and destructor
+        Trivially copyable types are detected automatically, other types can opt in by specializing this trait
+    */
+    template<typename T>
+    struct IsTriviallyRelocatable : std::bool_constant<std::is_trivially_copyable_v<T>>
+    {
+    };
+
+    template<typename T>
+    constexpr inline bool IS_TRIVIALLY_RELOCATABLE = IsTriviallyRelocatable<T>::value;
+
+    /*
+        Types whose containers keep added and changed ticks for every element, required for Changed and Added query terms
+        Ticks take 16 bytes per element, so types opt in by specializing this trait and the rest don't pay for them
+    */
+    template<typename T>
+    struct IsChangeTracked : std::false_type
+    {
+    };
+
+    template<typename T>
+    constexpr inline bool IS_CHANGE_TRACKED = IsChangeTracked<T>::value;
+
+    /*
+        Defines how much capacity containers allocate
+        New capacity is at least capacity * factor and at least capacity + minimal step,
+        if page size is set, allocation size in bytes is rounded up to a multiple of it
+        If chunk size is set, archetypes store rows in chunks that fit into it instead of single arrays per column,
+        every chunk holds all components, ticks and entity ids of its rows, so growing only allocates a new chunk
+        and never moves existing rows, growth factor and page size are not used in that case
+    */
+    struct GrowthPolicy
+    {
+        float m_factor = 1.5f;
+        std::size_t m_minStep = 16; // In elements
+        std::size_t m_pageSize = 0; // In bytes, 0 to disable rounding
+        std::size_t m_initialCapacity = 16; // In elements, used for newly created archetypes
+        std::size_t m_chunkSize = 0; // In bytes, rows of a chunk are picked so all their components fit into it, 0 to disable chunks
+
+        std::size_t nextCapacity(std::size_t capacity_, std::size_t required_, std::size_t entrySize_) const;
+    };
+
+    /*
+        Memory of a chunked archetype, every chunk holds the same range of rows for all its columns
+        Columns know byte offsets of their elements and ticks inside of a chunk (see UntypeContainer::setChunks)
+        Growing only allocates new chunks, so rows never move
+        Only owns memory, elements are constructed and destroyed by containers
+    */
+    class ChunkStorage
+    {
+    public:
+        ChunkStorage() = default;
+
+        ChunkStorage(const ChunkStorage &rhs_) = delete;
+        ChunkStorage &operator=(const ChunkStorage &rhs_) = delete;
+
+        // Frees all chunks and sets new layout, rows_ should be a power of two, 0 to disable chunks
+        void setLayout(std::size_t rows_, std::size_t chunkBytes_, std::size_t alignment_);
+
+        // Allocates new chunks until required_ rows fit
+        void grow(std::size_t required_);
+
+        // Rows per chunk, 0 if layout is not set
+        inline std::size_t getRows() const
+        {
+            return m_rows;
+        }
+
+        inline std::size_t capacity() const
+        {
+            return m_chunks.size() << m_shift;
+        }
+
+        // Start of the chunk that holds row_
+        inline std::byte *getChunk(std::size_t row_) const
+        {
+            return m_chunks[row_ >> m_shift];
+        }
+
+        // Index of row_ inside of its chunk
+        inline std::size_t getOffset(std::size_t row_) const
+        {
+            return row_ & (m_rows - 1);
+        }
+
+        ~ChunkStorage();
+
+    private:
+        void release();
+
+        std::vector<std::byte*> m_chunks;
+        std::size_t m_rows = 0;
+        std::size_t m_shift = 0;
+        std::size_t m_chunkBytes = 0;
+        std::size_t m_alignment = alignof(std::max_align_t);
+    };
+
     /*
         Container for optional data type
         Stores data linearly as raw bytes, converts only on access
+        Capacity is kept uninitialized, objects are constructed in place on insert and destroyed on remove,
+        so stored types are not required to be default constructible
+        Trivially relocatable types are stored in malloc'ed memory, grown with realloc and moved around with memcpy
         When a field is deleted, moved last field to it instead of moving entire array
+        Alternatively elements can be stored in chunks of a ChunkStorage shared with other columns of an archetype,
+        then growing only allocates new chunks and never moves existing elements, elements are contiguous only within a chunk
+        Elements of change tracked types (see IsChangeTracked) also have ticks of when they were added and last changed,
+        ticks follow the element when it moves, new elements get the current tick of the tick source
+        Ticks are kept in the same chunks as elements or in separate arrays without chunks
         TODO: might make it just an interface with an actual object knowing about type
         Virtual calls are a bit faster than calls to lambdas through interface plus it will allow some optimization
         because currently container does not know its type and registry / archetype often need to iterate over all components
@@ -26,17 +148,19 @@ namespace ECS
         template<typename T>
         bool allocate(int count_)
         {
-            if (m_data)
+            if (m_cleaner)
                 return false;
 
             m_entrySize = sizeof(T);
+            m_entryAlign = alignof(T);
+            m_tracked = IS_CHANGE_TRACKED<T>;
             m_capacity = count_;
             m_size = 0;
-            m_data = new T[count_];
+            m_data = allocateRaw<T>(count_);
 
-            m_cleaner = [](void* data_)
+            m_cleaner = [](UntypeContainer *container_)
             {
-                delete []static_cast<T*>(data_);
+                container_->freemem<T>();
             };
 
             m_callRealloc = [](UntypeContainer *container_, size_t newCapacity_)
@@ -49,28 +173,65 @@ namespace ECS
                 container_->removeAt<T>(id_);
             };
 
+            m_callAppendFrom = [](UntypeContainer *container_, UntypeContainer *src_, const size_t *ids_, size_t count_)
+            {
+                container_->appendFrom<T>(*src_, ids_, count_);
+            };
+
+            m_callCompact = [](UntypeContainer *container_, const size_t *holes_, const size_t *fillers_, size_t count_, size_t newSize_)
+            {
+                container_->compact<T>(holes_, fillers_, count_, newSize_);
+            };
+
+            if constexpr (std::is_default_constructible_v<T>)
+            {
+                m_callAppendDefault = [](UntypeContainer *container_, size_t count_)
+                {
+                    container_->ensureCapacity<T>(container_->m_size + count_);
+                    auto first = container_->m_size;
+                    container_->forRuns<T>(first, count_, [container_](T *run_, std::size_t runSize_)
+                    {
+                        std::uninitialized_value_construct_n(run_, runSize_);
+                        container_->m_size += runSize_;
+                    });
+                    container_->growTicks(first);
+                };
+            }
+            else
+                m_callAppendDefault = nullptr;
+
+            m_callSetChunks = [](UntypeContainer *container_, ChunkStorage *storage_, size_t dataOffset_, size_t addedOffset_, size_t changedOffset_)
+            {
+                container_->setChunks<T>(storage_, dataOffset_, addedOffset_, changedOffset_);
+            };
+
             return true;
         }
 
         template<typename T>
         bool allocated() const
         {
-            return m_data;
+            return m_cleaner;
         }
 
         template<typename T>
         bool freemem()
         {
-            if (!m_data)
+            if (!m_cleaner)
                 return false;
 
-            delete []static_cast<T*>(m_data);
+            releaseStorage<T>();
+            m_storage = nullptr;
             m_entrySize = 0;
-            m_capacity = 0;
-            m_data = nullptr;
+            m_entryAlign = 0;
+            m_tracked = false;
             m_cleaner = nullptr;
             m_callRealloc = nullptr;
             m_callRemoveAt = nullptr;
+            m_callAppendFrom = nullptr;
+            m_callCompact = nullptr;
+            m_callAppendDefault = nullptr;
+            m_callSetChunks = nullptr;
 
             return true;
         }
@@ -78,46 +239,188 @@ namespace ECS
         template<typename T>
         T &get(std::size_t id_)
         {
-            return static_cast<T*>(m_data)[id_];
+            return *at<T>(id_);
+        }
+
+        // Raw typed pointer to the element, following elements are contiguous up to the end of its chunk, invalidated by any reallocation
+        template<typename T>
+        T *data(std::size_t id_ = 0)
+        {
+            if (m_storage && id_ >= m_storage->capacity())
+                return nullptr;
+
+            return at<T>(id_);
         }
 
         std::size_t size() const;
+        std::size_t capacity() const;
+        std::size_t entrySize() const;
+        std::size_t entryAlign() const;
+
+        // Whether elements have ticks, chunks only need room for them in that case
+        bool tracksChanges() const;
+
+        /*
+            Switches between a single array (nullptr) and chunks of storage_
+            Elements and their ticks are placed at passed byte offsets inside of every chunk
+            Only possible while container is empty, throws otherwise
+        */
+        void setChunks(ChunkStorage *storage_, std::size_t dataOffset_, std::size_t addedOffset_, std::size_t changedOffset_);
+        std::size_t getChunkRows() const;
+
+        // Source of the current tick, elements added without it have tick 0
+        void setTickSource(const std::atomic<Tick> *tickSource_);
+        Tick getCurrentTick() const;
+
+        /*
+            Ticks starting from the element, following ticks are contiguous up to the end of its chunk, invalidated by any reallocation
+            nullptr if type is not change tracked
+        */
+        const Tick *addedTicks(std::size_t id_ = 0) const;
+        const Tick *changedTicks(std::size_t id_ = 0) const;
+        Tick *changedTicks(std::size_t id_ = 0);
+
+        // Do nothing if type is not change tracked
+        void markChanged(std::size_t id_, Tick tick_);
+        void markChanged(std::size_t id_);
+
+        // Ensures that container can hold at least capacity_ elements without reallocation
+        void reserve(std::size_t capacity_);
+
+        void setGrowthPolicy(const GrowthPolicy &growth_);
 
         template <typename T>
         void push_back(T &&rhs_)
         {
-            if (m_size == m_capacity)
-                realloc<T>(m_capacity * 1.3);
+            emplace_back<std::remove_cvref_t<T>>(std::forward<T>(rhs_));
+        }
+
+        // Constructs new element at the end from passed arguments
+        template <typename T, typename... Args>
+        T &emplace_back(Args&&... args_)
+        {
+            ensureCapacity<T>(m_size + 1);
 
-            static_cast<T*>(m_data)[m_size] = std::move(rhs_);
-            ++m_size;
+            auto *res = std::construct_at(at<T>(m_size), std::forward<Args>(args_)...);
+            growTicks(m_size++);
+            return *res;
         }
 
+        // Default constructs new element at the end, throws if type is not default constructible
         void push_back();
 
+        // Default constructs count_ new elements at the end, throws if type is not default constructible
+        void appendDefault(std::size_t count_);
+
+        // Constructs count_ new elements at the end from a BatchSource, grows storage at most once
+        template<typename T, typename S>
+        void append(std::size_t count_, S &&src_)
+        {
+            ensureCapacity<T>(m_size + count_);
+
+            std::size_t i = 0;
+            auto first = m_size;
+            forRuns<T>(first, count_, [&](T *run_, std::size_t runSize_)
+            {
+                for (std::size_t j = 0; j < runSize_; ++j)
+                {
+                    std::construct_at(run_ + j, BatchSource<std::remove_cvref_t<S>>::get(src_, i++));
+                    ++m_size;
+                }
+            });
+
+            growTicks(first);
+        }
+
+        // Move constructs new element at the end from an element of another container with the same type
+        void pushFrom(UntypeContainer &src_, std::size_t id_);
+
+        // Move constructs new elements at the end from listed elements of another container with the same type
+        void appendFrom(UntypeContainer &src_, const std::size_t *ids_, std::size_t count_);
+
+        /*
+            Same as above, storage grows at most once and ticks are copied in a single pass
+            Trivially copyable elements are copied with one memcpy per run of consecutive ids, other types are move constructed,
+            since source still destroys its rows when they are removed
+        */
+        template<typename T>
+        void appendFrom(UntypeContainer &src_, const std::size_t *ids_, std::size_t count_)
+        {
+            ensureCapacity<T>(m_size + count_);
+
+            const auto *listed = ids_;
+            forRuns<T>(m_size, count_, [&](T *run_, std::size_t runSize_)
+            {
+                for (std::size_t i = 0; i < runSize_;)
+                {
+                    if constexpr (std::is_trivially_copyable_v<T>)
+                    {
+                        auto len = src_.countConsecutive(listed + i, runSize_ - i);
+                        std::memcpy(static_cast<void*>(run_ + i), static_cast<const void*>(src_.at<T>(listed[i])), len * sizeof(T));
+                        i += len;
+                    }
+                    else
+                    {
+                        std::construct_at(run_ + i, std::move(*src_.at<T>(listed[i])));
+                        ++i;
+                    }
+                }
+
+                listed += runSize_;
+                m_size += runSize_;
+            });
+
+            copyTicks(src_, ids_, count_);
+        }
+
+        /*
+            Moves fillers into holes pairwise and destroys everything starting from newSize_
+            Used to remove a number of elements in a single pass
+        */
+        template<typename T>
+        void compact(const std::size_t *holes_, const std::size_t *fillers_, std::size_t count_, std::size_t newSize_)
+        {
+            for (std::size_t i = 0; i < count_; ++i)
+                *at<T>(holes_[i]) = std::move(*at<T>(fillers_[i]));
+
+            forRuns<T>(newSize_, m_size - newSize_, [](T *run_, std::size_t runSize_) { std::destroy_n(run_, runSize_); });
+            m_size = newSize_;
+            compactTicks(holes_, fillers_, count_);
+        }
+
+        void compact(const std::size_t *holes_, const std::size_t *fillers_, std::size_t count_, std::size_t newSize_);
+
         template <typename T>
         void emplace(T &&rhs_, std::size_t id_)
         {
-            static_cast<T*>(m_data)[id_] = std::move(rhs_);
+            *at<std::remove_cvref_t<T>>(id_) = std::forward<T>(rhs_);
+            markChanged(id_);
         }
 
         template<typename T>
         bool removeAt(std::size_t newIdx_)
         {
-            if (newIdx_ > m_size - 1)
+            if (newIdx_ >= m_size)
                 return false;
-            else if (newIdx_ == m_size - 1)
+
+            auto *removed = at<T>(newIdx_);
+            auto *last = at<T>(--m_size);
+            if constexpr (IS_TRIVIALLY_RELOCATABLE<T>)
             {
-                --m_size;
-                return true;
+                std::destroy_at(removed);
+                if (newIdx_ != m_size)
+                    std::memcpy(static_cast<void*>(removed), static_cast<const void*>(last), sizeof(T));
             }
             else
             {
-                auto *realarr = static_cast<T*>(m_data);
-                --m_size;
-                realarr[newIdx_] = std::move(realarr[m_size]);
-                return true;
+                if (newIdx_ != m_size)
+                    *removed = std::move(*last);
+
+                std::destroy_at(last);
             }
+
+            removeTicks(newIdx_);
+            return true;
         }
 
         void removeAt(std::size_t newIdx_);
@@ -125,33 +428,230 @@ namespace ECS
         ~UntypeContainer();
 
     private:
+        // Ticks for elements starting from first_ get the current tick
+        void growTicks(std::size_t first_);
+
+        // Ticks for the last count_ elements are taken from listed elements of another container
+        void copyTicks(const UntypeContainer &src_, const std::size_t *ids_, std::size_t count_);
+
+        // Amount of leading ids that go one after another and are stored contiguously, at least 1, at most max_
+        std::size_t countConsecutive(const std::size_t *ids_, std::size_t max_) const;
+
+        // Same as compact and removeAt for elements, called after size is already updated
+        void compactTicks(const std::size_t *holes_, const std::size_t *fillers_, std::size_t count_);
+        void removeTicks(std::size_t id_);
+
         template<typename T>
-        void realloc(std::size_t newCapacity_)
+        inline T *at(std::size_t id_) const
+        {
+            if (m_storage)
+                return static_cast<T*>(inChunk(m_dataOffset, id_)) + m_storage->getOffset(id_);
+
+            return static_cast<T*>(m_data) + id_;
+        }
+
+        inline Tick *addedTickAt(std::size_t id_) const
+        {
+            if (m_storage)
+                return static_cast<Tick*>(inChunk(m_addedOffset, id_)) + m_storage->getOffset(id_);
+
+            return const_cast<Tick*>(m_addedTicks.data()) + id_;
+        }
+
+        inline Tick *changedTickAt(std::size_t id_) const
+        {
+            if (m_storage)
+                return static_cast<Tick*>(inChunk(m_changedOffset, id_)) + m_storage->getOffset(id_);
+
+            return const_cast<Tick*>(m_changedTicks.data()) + id_;
+        }
+
+        // Start of the region at offset_ inside of the chunk with element id_
+        inline void *inChunk(std::size_t offset_, std::size_t id_) const
+        {
+            return m_storage->getChunk(id_) + offset_;
+        }
+
+        // Calls f_ with pointer and length of every contiguous run of elements in [first_, first_ + count_)
+        template<typename T, typename F>
+        void forRuns(std::size_t first_, std::size_t count_, F &&f_)
         {
-            T* oldData = static_cast<T*>(m_data);
+            if (!m_storage)
+            {
+                if (count_ > 0)
+                    f_(static_cast<T*>(m_data) + first_, count_);
+
+                return;
+            }
+
+            while (count_ > 0)
+            {
+                auto offset = m_storage->getOffset(first_);
+                auto runSize = std::min(count_, m_storage->getRows() - offset);
+                f_(static_cast<T*>(inChunk(m_dataOffset, first_)) + offset, runSize);
+                first_ += runSize;
+                count_ -= runSize;
+            }
+        }
+
+        // Destroys all elements and frees all owned memory, but keeps the type, chunks belong to their storage
+        template<typename T>
+        void releaseStorage()
+        {
+            forRuns<T>(0, m_size, [](T *run_, std::size_t runSize_) { std::destroy_n(run_, runSize_); });
+
             if (m_data)
+                freeRaw<T>(m_data);
+
+            m_data = nullptr;
+            m_capacity = 0;
+            m_size = 0;
+            m_addedTicks.clear();
+            m_changedTicks.clear();
+        }
+
+        template<typename T>
+        void setChunks(ChunkStorage *storage_, std::size_t dataOffset_, std::size_t addedOffset_, std::size_t changedOffset_)
+        {
+            if (m_size > 0)
+                throw std::exception();
+
+            releaseStorage<T>();
+            m_storage = storage_;
+            m_dataOffset = dataOffset_;
+            m_addedOffset = addedOffset_;
+            m_changedOffset = changedOffset_;
+
+            if (m_storage)
+                m_capacity = m_storage->capacity();
+            else
+                m_data = allocateRaw<T>(0);
+        }
+
+        // Relocatable types with fundamental alignment live in malloc'ed memory so they can be grown with realloc
+        template<typename T>
+        static constexpr bool USES_C_ALLOCATION = IS_TRIVIALLY_RELOCATABLE<T> && alignof(T) <= alignof(std::max_align_t);
+
+        template<typename T>
+        static void *allocateRaw(std::size_t count_)
+        {
+            if constexpr (USES_C_ALLOCATION<T>)
             {
-                T* newData = new T[newCapacity_];
-                auto maxid = std::min(newCapacity_ - 1, m_size - 1);
-                for (int i = 0; i <= maxid; ++i)
-                    newData[i] = std::move(oldData[i]);
+                auto *res = std::malloc(std::max<std::size_t>(count_, 1) * sizeof(T));
+                if (!res)
+                    throw std::bad_alloc();
+
+                return res;
+            }
+            else
+                return ::operator new(count_ * sizeof(T), std::align_val_t(alignof(T)));
+        }
+
+        template<typename T>
+        static void freeRaw(void *data_)
+        {
+            if constexpr (USES_C_ALLOCATION<T>)
+                std::free(data_);
+            else
+                ::operator delete(data_, std::align_val_t(alignof(T)));
+        }
+
+        // Grows according to growth policy if required_ elements don't fit
+        template<typename T>
+        inline void ensureCapacity(std::size_t required_)
+        {
+            if (required_ > m_capacity)
+                realloc<T>(m_storage ? required_ : m_growth.nextCapacity(m_capacity, required_, sizeof(T)));
+        }
+
+        /*
+            Moves elements into new storage, elements that don't fit are destroyed
+            With chunks only adds chunks to the shared storage, which might have been done by another column already
+        */
+        template<typename T>
+        void realloc(std::size_t newCapacity_)
+        {
+            if (!m_cleaner)
+                return;
+
+            if (m_storage)
+            {
+                m_storage->grow(newCapacity_);
+                m_capacity = m_storage->capacity();
+                return;
+            }
+
+            if constexpr (IS_TRIVIALLY_RELOCATABLE<T>)
+            {
+                auto newSize = std::min(newCapacity_, m_size);
+                std::destroy(static_cast<T*>(m_data) + newSize, static_cast<T*>(m_data) + m_size);
+
+                if constexpr (USES_C_ALLOCATION<T>)
+                {
+                    auto *newData = std::realloc(m_data, std::max<std::size_t>(newCapacity_, 1) * sizeof(T));
+                    if (!newData)
+                        throw std::bad_alloc();
+
+                    m_data = newData;
+                }
+                else
+                {
+                    auto *newData = allocateRaw<T>(newCapacity_);
+                    std::memcpy(newData, m_data, newSize * sizeof(T));
+                    freeRaw<T>(m_data);
+                    m_data = newData;
+                }
+
+                m_size = newSize;
+            }
+            else
+            {
+                T* oldData = static_cast<T*>(m_data);
+                T* newData = static_cast<T*>(allocateRaw<T>(newCapacity_));
+                auto newSize = std::min(newCapacity_, m_size);
+
+                std::uninitialized_move_n(oldData, newSize, newData);
+                std::destroy_n(oldData, m_size);
+                freeRaw<T>(oldData);
 
-                delete[] oldData;
                 m_data = newData;
-                m_size = maxid + 1;
-                m_capacity = newCapacity_;
+                m_size = newSize;
+            }
+
+            // Ticks follow the capacity of elements, so pushes never grow them on their own
+            m_capacity = newCapacity_;
+            if (m_tracked)
+            {
+                m_addedTicks.resize(m_size);
+                m_changedTicks.resize(m_size);
+                m_addedTicks.reserve(newCapacity_);
+                m_changedTicks.reserve(newCapacity_);
             }
         }
 
-        void *m_data = nullptr;
+        void *m_data = nullptr; // Only used without chunks
+        ChunkStorage *m_storage = nullptr; // Shared chunks, nullptr if elements are stored in a single array
+        std::size_t m_dataOffset = 0; // Offsets of elements and their ticks inside of a chunk
+        std::size_t m_addedOffset = 0;
+        std::size_t m_changedOffset = 0;
         std::size_t m_capacity = 0; // Total amount of allocated elements
-        std::size_t m_size = 0; // Amount of used elements
+        std::size_t m_size = 0; // Amount of constructed elements
         std::size_t m_entrySize = 0; // Size of a single element
+        std::size_t m_entryAlign = 0;
+        bool m_tracked = false; // Whether elements have ticks
+        GrowthPolicy m_growth;
+        std::vector<Tick> m_addedTicks; // Only used without chunks
+        std::vector<Tick> m_changedTicks;
+        const std::atomic<Tick> *m_tickSource = nullptr;
 
         // Lambdas that know internal type and use it
-        void (*m_cleaner)(void*) = nullptr;
+        void (*m_cleaner)(UntypeContainer *container_) = nullptr;
         void (*m_callRealloc)(UntypeContainer *container_, std::size_t newCapacity_) = nullptr;
         void (*m_callRemoveAt)(UntypeContainer *container_, std::size_t id_) = nullptr;
+        void (*m_callAppendFrom)(UntypeContainer *container_, UntypeContainer *src_, const std::size_t *ids_, std::size_t count_) = nullptr;
+        void (*m_callCompact)(UntypeContainer *container_, const std::size_t *holes_, const std::size_t *fillers_, std::size_t count_, std::size_t newSize_) = nullptr;
+        void (*m_callAppendDefault)(UntypeContainer *container_, std::size_t count_) = nullptr;
+        void (*m_callSetChunks)(UntypeContainer *container_, ChunkStorage *storage_, std::size_t dataOffset_, std::size_t addedOffset_, std::size_t changedOffset_) = nullptr;
     };
 }
 
@@ -3,13 +3,24 @@
 #include "Utils.h"
 #include "TypeManip.hpp"
 #include "Archetype.hpp"
+#include "QueryFilter.hpp"
+#include "ArchetypeIndex.hpp"
+#include "Trace.h"
+#include "JobSystem.h"
 #include <tuple>
 #include <concepts>
 #include <vector>
 #include <string>
 #include <iostream>
-#include <bitset>
 #include <unordered_set>
+#include <unordered_map>
+#include <span>
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <atomic>
+#include <functional>
+#include <array>
 
 namespace ECS
 {
@@ -22,6 +33,54 @@ namespace ECS
         size_t m_entityId;
     };
 
+    // Contiguous range of rows within a single archetype
+    struct EntityRange
+    {
+        size_t m_archetypeId;
+        size_t m_first;
+        size_t m_count;
+
+        inline EntityIndex operator[](size_t id_) const
+        {
+            return {m_archetypeId, m_first + id_};
+        }
+
+        inline size_t size() const
+        {
+            return m_count;
+        }
+    };
+
+    /*
+        Stable handle for an entity
+        Unlike EntityIndex, stays valid after any structural changes until entity is removed
+        Generation is increased every time a slot is freed, so handles to removed entities can be detected
+    */
+    struct EntityHandle
+    {
+        EntityId m_id = INVALID_ENTITY;
+        uint32_t m_generation = 0;
+
+        bool operator==(const EntityHandle &rhs_) const = default;
+    };
+
+    enum class ObserverEvent
+    {
+        ADD, // Entity started to have all observed components, fired after the operation
+        REMOVE, // Entity is about to lose one of observed components or to be removed, fired before the operation
+        MOVE // Entity keeps all observed components, but its location has changed, fired after the operation
+    };
+
+    // Entity passed to observers, index is location after the operation, or before it for REMOVE
+    struct ObservedEntity
+    {
+        EntityHandle m_handle;
+        EntityIndex m_index;
+    };
+
+    // Receives all entities affected by a single operation at once, should not add or remove entities, components or observers
+    using ObserverCallback = std::function<void(std::span<const ObservedEntity>)>;
+
     /*
         Another view for entity
     */
@@ -44,7 +103,7 @@ namespace ECS
         template<typename... Ts>
         bool contains() const
         {
-            return m_reg[m_idx.m_archetypeId].template  containsComponents<Ts...>();
+            return m_reg[m_idx.m_archetypeId].template containsComponents<Ts...>();
         }
 
     private:
@@ -53,55 +112,148 @@ namespace ECS
     };
 
 
+    /*
+        Archetypes matching a filter, owned and kept up to date by the registry
+        Every new archetype is pushed to all matching caches once when it is created
+    */
+    template<typename TReg>
+    struct QueryCache
+    {
+        QueryCache(const QueryFilter<TReg> &filter_) :
+            m_filter(filter_)
+        {
+        }
+
+        QueryFilter<TReg> m_filter;
+        std::vector<size_t> m_archIds;
+    };
+
+    /*
+        Lightweight handle to a query cache of a registry, cheap to copy and always up to date
+        Stays valid as long as the registry exists
+        Every iteration is a run with its own tick, Changed and Added terms compare against the tick of the previous run of this handle
+    */
     template<typename TReg>
     class Query
     {
     public:
-        Query(Registry<TReg> &reg_, const std::bitset<TReg::MaxID> &mask_, size_t lastArchSize_) :
+        Query(Registry<TReg> &reg_, QueryCache<TReg> &cache_) :
             m_reg(reg_),
-            m_mask(mask_),
-            m_lastArchSize(lastArchSize_)
+            m_cache(&cache_)
+        {
+        }
+
+        const std::vector<size_t> &getArchetypes() const
         {
+            return m_cache->m_archIds;
         }
 
-        void update()
+        /*
+            Iterates forward, from first archetype to last, from first entity to last, passes head, index and required components
+            Components wrapped into Optional are passed as pointers, nullptr if archetype doesn't have them
+            Column pointers are resolved once per archetype (or per chunk), so the inner loop is a plain walk over arrays
+            Callback should not add or remove entities, use revapply for that
+        */
+        template<typename... Comps, typename F, typename... Head> 
+        void apply(F f_, Head&&... head_)
         {
-            auto newsz = m_reg.size();
-            if (newsz > m_lastArchSize)
+            const auto since = m_lastRun;
+            const auto tick = startRun();
+
+            EntityIndex idx;
+            for (size_t arch = 0; arch < m_cache->m_archIds.size(); ++arch)
             {
-                std::cout << "View " << m_mask << " is outdated, " << m_lastArchSize << " / " << newsz << std::endl;
-                for (;m_lastArchSize < newsz; ++m_lastArchSize) 
+                idx.m_archetypeId = m_cache->m_archIds[arch];
+                auto &archetype = m_reg[idx.m_archetypeId];
+                if (!isMatching<Comps...>(archetype))
+                    continue;
+
+                const size_t archsize = archetype.size();
+                for (size_t first = 0; first < archsize;)
                 {
-                    auto archmask = m_reg[m_lastArchSize].getMask();
-                    if ((m_mask & archmask) == m_mask)
+                    const size_t last = archetype.getChunkEnd(first);
+                    RowFilter<TReg> rows(archetype, m_cache->m_filter, since, first);
+                    [&](QueryColumn<TReg, Comps>... cols_)
                     {
-                        std::cout << "Found new viable archetype " << archmask << std::endl;
-                        m_archIds.push_back(m_lastArchSize);
-                    }
+                        // Without Changed and Added terms every row is visited, so the whole chunk is marked at once
+                        if (rows.empty())
+                            (cols_.markChanged(0, last - first), ...);
+
+                        for (size_t i = first; i < last; ++i)
+                        {
+                            if (!rows.empty())
+                            {
+                                if (!rows.passes(i - first))
+                                    continue;
+
+                                (cols_.markChanged(i - first), ...);
+                            }
+
+                            idx.m_entityId = i;
+                            f_(std::forward<Head>(head_)..., idx, cols_[i - first]...);
+                        }
+                    } (QueryColumn<TReg, Comps>(archetype, tick, first)...);
+
+                    first = last;
                 }
             }
-            else
-            {
-                std::cout << "View " << m_mask << " is up to date" << std::endl;
-            }
         }
 
-        // Iterates forward, from first archetype to last, from first entity to last, passes head, index and required components
-        template<typename... Comps, typename F, typename... Head> 
-        void apply(F f_, Head&&... head_)
+        /*
+            Same as apply, but splits matching archetypes into chunks of at most grainSize_ rows and runs them on the job system,
+            chunks never cross chunks of archetype storage
+            Callback gets the same index and components, but is called concurrently for different rows in no particular order,
+            so it should only touch its own row and should not add or remove entities or components
+        */
+        template<typename... Comps, typename F>
+        void parallelApply(JobSystem &jobs_, F f_, size_t grainSize_ = 1024)
         {
-            EntityIndex idx;
-            for (size_t arch = 0; arch < m_archIds.size(); ++arch)
+            grainSize_ = std::max<size_t>(grainSize_, 1);
+            const auto since = m_lastRun;
+            const auto tick = startRun();
+
+            std::vector<EntityRange> chunks;
+            for (auto archId : m_cache->m_archIds)
             {
-                idx.m_archetypeId = m_archIds[arch];
-                if (!m_reg[idx.m_archetypeId].containsComponents<Comps...>())
+                auto &archetype = m_reg[archId];
+                if (!isMatching<Comps...>(archetype))
                     continue;
 
-                for (idx.m_entityId = 0; idx.m_entityId < m_reg[idx.m_archetypeId].size(); ++idx.m_entityId)
+                const size_t archsize = archetype.size();
+                for (size_t first = 0; first < archsize;)
                 {
-                    f_(std::forward<Head>(head_)..., idx, m_reg[idx.m_archetypeId].template getComponent<Comps>(idx.m_entityId)...);
+                    const size_t count = std::min(grainSize_, archetype.getChunkEnd(first) - first);
+                    chunks.push_back({archId, first, count});
+                    first += count;
                 }
             }
+
+            jobs_.parallelFor(chunks.size(), [&](size_t chunkId_)
+            {
+                const auto &chunk = chunks[chunkId_];
+                auto &archetype = m_reg[chunk.m_archetypeId];
+                RowFilter<TReg> rows(archetype, m_cache->m_filter, since, chunk.m_first);
+                [&](QueryColumn<TReg, Comps>... cols_)
+                {
+                    if (rows.empty())
+                        (cols_.markChanged(0, chunk.m_count), ...);
+
+                    EntityIndex idx{chunk.m_archetypeId, 0};
+                    for (size_t i = chunk.m_first; i < chunk.m_first + chunk.m_count; ++i)
+                    {
+                        if (!rows.empty())
+                        {
+                            if (!rows.passes(i - chunk.m_first))
+                                continue;
+
+                            (cols_.markChanged(i - chunk.m_first), ...);
+                        }
+
+                        idx.m_entityId = i;
+                        f_(idx, cols_[i - chunk.m_first]...);
+                    }
+                } (QueryColumn<TReg, Comps>(archetype, tick, chunk.m_first)...);
+            });
         }
 
         /*
@@ -109,43 +261,60 @@ namespace ECS
             Is guaranteed to work well with entity remove / add operations
             In case of remove, last entity will be pushed to the current position and wont be processed twice
             In case of add, new entity will be pushed to the end of the list and will not be proceded
+            Column pointers are cached per archetype (or per chunk) and only resolved again if callback changed amount of archetypes
+            or entities in current archetype, since it might have caused reallocation
         */
         template<typename... Comps, typename F>
         void revapply(F f_)
         {
+            const auto since = m_lastRun;
+            const auto tick = startRun();
+
             EntityIndex idx;
-            for (size_t arch = m_archIds.size() - 1; true; --arch)
+            for (size_t arch = m_cache->m_archIds.size(); arch-- > 0;)
             {
-                idx.m_archetypeId = m_archIds[arch];
-                if (!m_reg[idx.m_archetypeId].containsComponents<Comps...>() || m_reg[idx.m_archetypeId].size() == 0)
+                idx.m_archetypeId = m_cache->m_archIds[arch];
+                if (!isMatching<Comps...>(m_reg[idx.m_archetypeId]) || m_reg[idx.m_archetypeId].size() == 0)
+                    continue;
+
+                std::tuple<QueryColumn<TReg, Comps>...> cols;
+                std::optional<RowFilter<TReg>> rows;
+                size_t archcount = 0;
+                size_t archsize = 0;
+                size_t first = 0;
+                auto resolve = [&]()
                 {
-                    if (arch == 0)
-                        break;
-                    else
-                        continue;
-                }
+                    auto &archetype = m_reg[idx.m_archetypeId];
+                    first = archetype.getChunkBegin(idx.m_entityId);
+                    cols = std::make_tuple(QueryColumn<TReg, Comps>(archetype, tick, first)...);
+                    rows.emplace(archetype, m_cache->m_filter, since, first);
+                    archcount = m_reg.size();
+                    archsize = archetype.size();
+                };
 
-                for (idx.m_entityId = m_reg[idx.m_archetypeId].size() - 1; true; --idx.m_entityId)
+                for (idx.m_entityId = m_reg[idx.m_archetypeId].size(); idx.m_entityId-- > 0;)
                 {
-                    f_(idx, m_reg[idx.m_archetypeId].template getComponent<Comps>(idx.m_entityId)...);
+                    if (!rows || idx.m_entityId < first || archcount != m_reg.size() || archsize != m_reg[idx.m_archetypeId].size())
+                        resolve();
 
-                    if (idx.m_entityId == 0)
-                        break;
-                }
+                    if (!rows->empty() && !rows->passes(idx.m_entityId - first))
+                        continue;
 
-                if (arch == 0)
-                    break;
+                    (std::get<QueryColumn<TReg, Comps>>(cols).markChanged(idx.m_entityId - first), ...);
+                    f_(idx, std::get<QueryColumn<TReg, Comps>>(cols)[idx.m_entityId - first]...);
+                }
             }
         }
 
         // Iterates forward, from first archetype to last, from first entity to last, passes head, index and view
+        // Ignores Changed and Added terms, components are marked only if they are accessed through the view as non-const
         template<typename F, typename... Head> 
         void applyview(F f_, Head&&... head_)
         {
             EntityIndex idx;
-            for (size_t arch = 0; arch < m_archIds.size(); ++arch)
+            for (size_t arch = 0; arch < m_cache->m_archIds.size(); ++arch)
             {
-                idx.m_archetypeId = m_archIds[arch];
+                idx.m_archetypeId = m_cache->m_archIds[arch];
 
                 for (idx.m_entityId = 0; idx.m_entityId < m_reg[idx.m_archetypeId].size(); ++idx.m_entityId)
                 {
@@ -154,12 +323,24 @@ namespace ECS
             }
         }
 
-        std::vector<size_t> m_archIds;
-
     private:
+        // Archetypes in cache can still miss components that are requested by callback but not by the query itself
+        template<typename... Comps>
+        static bool isMatching(const Archetype<TReg> &arch_)
+        {
+            return (QueryColumn<TReg, Comps>::isPresent(arch_) && ...);
+        }
+
+        // Returns tick of the new run, changes made during it are not visible to the next run of this handle
+        Tick startRun()
+        {
+            m_lastRun = m_reg.advanceTick();
+            return m_lastRun;
+        }
+
         Registry<TReg> &m_reg;
-        std::bitset<TReg::MaxID> m_mask;
-        size_t m_lastArchSize;
+        QueryCache<TReg> *m_cache;
+        Tick m_lastRun = 0;
     };
 
     template<typename TReg>
@@ -169,38 +350,112 @@ namespace ECS
         template<typename... Comps, typename... Emplaced> requires TypeManip::TemplateExists<Comps...>
         EntityIndex createEntity(Emplaced&&... comps_)
         {
+            static_assert(((std::is_default_constructible_v<Comps> || TypeManip::isListed<Comps, std::remove_cvref_t<Emplaced>...>()) && ...),
+                "Components that are not default constructible should be passed to createEntity");
+
             auto archid = getEnsureArchetype<Comps...>();
-            EntityIndex newent {archid, m_archetypes[archid].addEntity()};
-            m_archetypes[archid].emplaceComponents(newent.m_entityId, std::forward<Emplaced>(comps_)...);
+            auto entity = allocateEntity();
+            EntityIndex newent {archid, m_archetypes[archid].addEntity(entity, std::forward<Emplaced>(comps_)...)};
+            m_entities[entity].m_index = newent;
+
+            if (isObserved(ObserverEvent::ADD))
+                notifySingle(ObserverEvent::ADD, {}, m_archetypes[archid].getMask(), newent);
+
             return newent;
         }
 
+        /*
+            Creates count_ entities with the same set of components in a single archetype
+            Every source is either a prototype, a std::span or a generator called with index within the batch (see BatchSource),
+            components without a source are default constructed
+            Returned range stays valid until first structural change in that archetype
+        */
+        template<typename... Comps, typename... Sources> requires TypeManip::TemplateExists<Comps...>
+        EntityRange createEntities(size_t count_, Sources&&... sources_)
+        {
+            static_assert(((std::is_default_constructible_v<Comps> || TypeManip::isListed<Comps, BatchComponent<Sources>...>()) && ...),
+                "Components that are not default constructible should have a source in createEntities");
+
+            auto archid = getEnsureArchetype<Comps...>();
+
+            std::vector<EntityId> entities(count_);
+            for (auto &el : entities)
+                el = allocateEntity();
+
+            auto first = m_archetypes[archid].addEntities(entities.data(), count_, std::forward<Sources>(sources_)...);
+            for (size_t i = 0; i < count_; ++i)
+                m_entities[entities[i]].m_index = {archid, first + i};
+
+            if (isObserved(ObserverEvent::ADD))
+                notifyRange(ObserverEvent::ADD, {}, m_archetypes[archid].getMask(), {archid, first, count_});
+
+            return {archid, first, count_};
+        }
+
         size_t size() const
         {
             return m_archetypes.size();
         }
 
+        // Pre-sizes archetype with specified components to hold at least count_ entities, creates it if necessary
+        template<typename... Comps> requires TypeManip::TemplateExists<Comps...>
+        void reserve(size_t count_)
+        {
+            m_archetypes[getEnsureArchetype<Comps...>()].reserve(count_);
+        }
+
+        // Tick that is given to added and changed components outside of query runs
+        Tick getTick() const
+        {
+            return m_tick->load();
+        }
+
+        // Returns tick for a new query run, every later change gets a greater tick
+        Tick advanceTick()
+        {
+            return m_tick->fetch_add(1);
+        }
+
+        // For components that were changed through references or pointers kept from an earlier access
+        template<typename T>
+        void markChanged(const EntityIndex &ent_)
+        {
+            m_archetypes[ent_.m_archetypeId].template markChanged<T>(ent_.m_entityId);
+        }
+
+        template<typename T>
+        void markChanged(const EntityHandle &ent_)
+        {
+            markChanged<T>(getAliveIndex(ent_));
+        }
+
+        // Used by all archetypes created after this call and applied to existing ones
+        void setGrowthPolicy(const GrowthPolicy &growth_)
+        {
+            m_growth = growth_;
+            for (auto &el : m_archetypes)
+                el.setGrowthPolicy(m_growth);
+        }
+
         // Components are expected to be unique
         template<typename... Comps> requires TypeManip::TemplateExists<Comps...>
         EntityIndex emplaceComponents(const EntityIndex &idx_, Comps&&... comps_)
         {
-            if (m_archetypes[idx_.m_archetypeId].template containsComponents<Comps...>())
+            if (m_archetypes[idx_.m_archetypeId].template containsComponents<std::remove_cvref_t<Comps>...>())
             {
                 m_archetypes[idx_.m_archetypeId].emplaceComponents(idx_.m_entityId, std::forward<Comps>(comps_)...);
                 return idx_;
             }
             else
             {
-                auto oldmask = m_archetypes[idx_.m_archetypeId].getMask();
-                auto newmask = extendMask<Comps...>(oldmask);
-
-                auto archid = getEnsureCopiedArchetype<Comps...>(idx_.m_archetypeId, newmask);
-                auto entId = m_archetypes[archid].addEntity();
-
-                
-                m_archetypes[archid].emplaceComponents(entId, std::forward<Comps>(comps_)...);
-                recursiveEmplace<1, Comps...>(m_archetypes[idx_.m_archetypeId], m_archetypes[archid], idx_.m_entityId, entId);
-                m_archetypes[idx_.m_archetypeId].removeEntity(idx_.m_entityId);
+                // Index might be a reference to the slot of this entity, so it is changed by the move
+                const auto oldArchId = idx_.m_archetypeId;
+                auto archid = getEnsureExtendedArchetype<std::remove_cvref_t<Comps>...>(idx_.m_archetypeId);
+                auto entity = m_archetypes[idx_.m_archetypeId].getEntity(idx_.m_entityId);
+                auto entId = m_archetypes[archid].addEntityFrom(entity, m_archetypes[idx_.m_archetypeId], idx_.m_entityId, std::forward<Comps>(comps_)...);
+                removeRow(idx_);
+                m_entities[entity].m_index = {archid, entId};
+                notifyTransition(oldArchId, EntityIndex{archid, entId});
 
                 return {archid, entId};
             }
@@ -210,32 +465,163 @@ namespace ECS
         template<typename... Comps> requires TypeManip::TemplateExists<Comps...>
         EntityIndex removeComponents(const EntityIndex &idx_)
         {
-            auto newmask = removeFromMask<Comps...>(m_archetypes[idx_.m_archetypeId].getMask());
-            auto newarch = 0;
+            auto newarch = getEnsureReducedArchetype<Comps...>(idx_.m_archetypeId);
+            if (newarch == idx_.m_archetypeId)
+                return idx_;
 
-            // Ensure that archetype with same components except listed exists
-            auto fnd = m_archTypes.find(newmask);
-            if (fnd == m_archTypes.end())
+            if (isObserved(ObserverEvent::REMOVE))
+                notifySingle(ObserverEvent::REMOVE, m_archetypes[idx_.m_archetypeId].getMask(), m_archetypes[newarch].getMask(), idx_);
+
+            const auto oldArchId = idx_.m_archetypeId;
+            auto entity = m_archetypes[idx_.m_archetypeId].getEntity(idx_.m_entityId);
+            auto newent = m_archetypes[newarch].addEntityFrom(entity, m_archetypes[idx_.m_archetypeId], idx_.m_entityId);
+            removeRow(idx_);
+            m_entities[entity].m_index = {newarch, newent};
+            notifyTransition(oldArchId, EntityIndex{newarch, newent});
+
+            return {newarch, newent};
+        }
+
+        void removeEntity(const EntityIndex &idx_)
+        {
+            if (idx_.m_entityId >= m_archetypes[idx_.m_archetypeId].size())
+                return;
+
+            if (isObserved(ObserverEvent::REMOVE))
+                notifySingle(ObserverEvent::REMOVE, m_archetypes[idx_.m_archetypeId].getMask(), {}, idx_);
+
+            freeEntity(m_archetypes[idx_.m_archetypeId].getEntity(idx_.m_entityId));
+            removeRow(idx_);
+        }
+
+        template<typename... Comps> requires TypeManip::TemplateExists<Comps...>
+        EntityIndex emplaceComponents(const EntityHandle &ent_, Comps&&... comps_)
+        {
+            return emplaceComponents(getAliveIndex(ent_), std::forward<Comps>(comps_)...);
+        }
+
+        template<typename... Comps> requires TypeManip::TemplateExists<Comps...>
+        EntityIndex removeComponents(const EntityHandle &ent_)
+        {
+            return removeComponents<Comps...>(getAliveIndex(ent_));
+        }
+
+        void removeEntity(const EntityHandle &ent_)
+        {
+            // Copied since slot is reset when entity is freed
+            if (isAlive(ent_))
+                removeEntity(EntityIndex(getIndex(ent_)));
+        }
+
+        /*
+            Adds components to all listed rows of a single archetype at once
+            Every source is a BatchSource, its i-th element goes to i-th listed row,
+            rows listed several times are moved once and get elements of their last listing, same as assigning them one by one
+            If archetype already has all components, they are assigned in place, otherwise entities are moved
+            to the target archetype with one bulk move per column and source archetype is compacted in a single pass
+            Returns range of moved entities in target archetype, empty if entities stayed in place
+        */
+        template<typename... Sources> requires TypeManip::TemplateExists<Sources...>
+        EntityRange emplaceComponentsBatch(size_t archId_, std::span<const size_t> rows_, Sources&&... sources_)
+        {
+            if (rows_.empty())
+                return {archId_, 0, 0};
+
+            if (m_archetypes[archId_].template containsComponents<BatchComponent<Sources>...>())
             {
-                std::cout << "Archetype " << newmask << " doesn't exist, creating new\n";
-                newarch = m_archetypes.size();
-                m_archTypes[newmask] = newarch;
-                m_archetypes.emplace_back();
-                m_archetypes[newarch].addTypesReduced<Comps...>(m_archetypes[idx_.m_archetypeId], 5);
+                auto &arch = m_archetypes[archId_];
+                ([&]
+                {
+                    using T = BatchComponent<Sources>;
+                    for (size_t i = 0; i < rows_.size(); ++i)
+                    {
+                        arch.template getComponent<T>(rows_[i]) = BatchSource<std::remove_cvref_t<Sources>>::get(sources_, i);
+                    }
+                } (), ...);
+
+                return {archId_, 0, 0};
             }
-            else
-                newarch = fnd->second;
 
-            auto newent = m_archetypes[newarch].addEntity();
-            recursiveMoveAllRequired<1>(m_archetypes[idx_.m_archetypeId], m_archetypes[newarch], idx_.m_entityId, newent);
-            m_archetypes[idx_.m_archetypeId].removeEntity(idx_.m_entityId);
+            auto newarch = getEnsureExtendedArchetype<BatchComponent<Sources>...>(archId_);
+            auto sorted = sortRows(rows_);
+            if (sorted.size() == rows_.size())
+                return moveEntitiesBatch(archId_, newarch, rows_, sorted, std::forward<Sources>(sources_)...);
 
-            return idx_;
+            auto listings = lastListings(rows_);
+            std::vector<size_t> rows(listings.size());
+            for (size_t i = 0; i < listings.size(); ++i)
+                rows[i] = rows_[listings[i]];
+
+            return moveEntitiesBatch(archId_, newarch, rows, sorted, relistSource(sources_, listings)...);
         }
 
-        void removeEntity(const EntityIndex &idx_)
+        // Same as above, but adds components to all entities in archetype for which predicate returns true
+        template<typename F, typename... Sources> requires TypeManip::TemplateExists<Sources...> && std::predicate<F&, const EntityIndex&>
+        EntityRange emplaceComponentsBatch(size_t archId_, F pred_, Sources&&... sources_)
+        {
+            auto rows = selectRows(archId_, pred_);
+            return emplaceComponentsBatch(archId_, std::span<const size_t>(rows), std::forward<Sources>(sources_)...);
+        }
+
+        /*
+            Removes components from all listed rows of a single archetype at once, rows listed several times are moved once
+            Returns range of moved entities in target archetype
+        */
+        template<typename... Comps> requires TypeManip::TemplateExists<Comps...>
+        EntityRange removeComponentsBatch(size_t archId_, std::span<const size_t> rows_)
         {
-            m_archetypes[idx_.m_archetypeId].removeEntity(idx_.m_entityId);
+            auto newarch = getEnsureReducedArchetype<Comps...>(archId_);
+            if (rows_.empty() || newarch == archId_)
+                return {archId_, 0, 0};
+
+            auto sorted = sortRows(rows_);
+            return moveEntitiesBatch(archId_, newarch, sorted, sorted);
+        }
+
+        template<typename... Comps, typename F> requires TypeManip::TemplateExists<Comps...> && std::predicate<F&, const EntityIndex&>
+        EntityRange removeComponentsBatch(size_t archId_, F pred_)
+        {
+            auto rows = selectRows(archId_, pred_);
+            return removeComponentsBatch<Comps...>(archId_, std::span<const size_t>(rows));
+        }
+
+        // Removes all listed rows of a single archetype in a single compaction pass, rows listed several times are removed once
+        void removeEntitiesBatch(size_t archId_, std::span<const size_t> rows_)
+        {
+            auto rows = sortRows(rows_);
+
+            if (isObserved(ObserverEvent::REMOVE))
+                notifyRows(ObserverEvent::REMOVE, m_archetypes[archId_].getMask(), {}, archId_, rows);
+
+            for (auto row : rows)
+                freeEntity(m_archetypes[archId_].getEntity(row));
+
+            removeRows(archId_, rows);
+        }
+
+        template<typename F> requires std::predicate<F&, const EntityIndex&>
+        void removeEntitiesBatch(size_t archId_, F pred_)
+        {
+            auto rows = selectRows(archId_, pred_);
+            removeEntitiesBatch(archId_, std::span<const size_t>(rows));
+        }
+
+        // Makes stable handle for an entity currently located at specified index
+        EntityHandle getHandle(const EntityIndex &idx_) const
+        {
+            auto entity = m_archetypes[idx_.m_archetypeId].getEntity(idx_.m_entityId);
+            return {entity, m_entities[entity].m_generation};
+        }
+
+        // Current location of the entity, handle is expected to be alive
+        inline const EntityIndex &getIndex(const EntityHandle &ent_) const
+        {
+            return m_entities[ent_.m_id].m_index;
+        }
+
+        inline bool isAlive(const EntityHandle &ent_) const
+        {
+            return ent_.m_id < m_entities.size() && m_entities[ent_.m_id].m_generation == ent_.m_generation && m_entities[ent_.m_id].m_alive;
         }
 
         void dumpAll()
@@ -245,20 +631,51 @@ namespace ECS
                 el.dumpAll();
         }
 
-        template<typename... Comps>
+        /*
+            Terms are component types or filters from QueryFilter.hpp: With, Without, Optional, AnyOf
+            Queries with the same filter share a single cache, so only the first call for a filter scans existing archetypes
+        */
+        template<typename... Terms>
         Query<TReg> makeQuery()
         {
-            constexpr std::bitset<TReg::MaxID> bset(((1ull << (TReg::template Get<Comps>() - 1)) | ...));
-            Query<TReg> res(*this, bset, m_archetypes.size());
+            auto filter = QueryFilter<TReg>::template make<Terms...>();
 
-            for (size_t archId = 0; archId < m_archetypes.size(); ++archId)
+            auto &cache = m_queries[filter];
+            if (!cache)
             {
-                auto &arch = m_archetypes[archId];
-                if (arch.containsComponents<Comps...>())
-                    res.m_archIds.push_back(archId);
+                cache = std::make_unique<QueryCache<TReg>>(filter);
+                for (size_t archId = 0; archId < m_archetypes.size(); ++archId)
+                {
+                    if (filter.matches(m_archetypes[archId].getMask()))
+                        cache->m_archIds.push_back(archId);
+                }
             }
 
-            return res;
+            return Query<TReg>(*this, *cache);
+        }
+
+        /*
+            Registers callback for entities that start or stop having all listed components or move while having them
+            Fired from all operations that add or remove entities or components, including batch ones, once per operation
+            Returns id for unobserve
+        */
+        template<typename... Comps>
+        size_t observe(ObserverEvent event_, ObserverCallback callback_)
+        {
+            constexpr auto mask = makeComponentMask<TReg, Comps...>();
+
+            m_observerCounts[static_cast<size_t>(event_)]++;
+            m_observers.push_back({event_, mask, std::move(callback_)});
+            return m_observers.size() - 1;
+        }
+
+        void unobserve(size_t id_)
+        {
+            if (id_ >= m_observers.size() || !m_observers[id_].m_callback)
+                return;
+
+            m_observerCounts[static_cast<size_t>(m_observers[id_].m_event)]--;
+            m_observers[id_].m_callback = nullptr;
         }
 
         Archetype<TReg> &operator[](std::size_t rhs_)
@@ -266,101 +683,415 @@ namespace ECS
             return m_archetypes[rhs_];
         }
 
+        // Non-const access to a change tracked component marks it as changed, getComponent<const T> only reads
         template<typename T>
         T &getComponent(const EntityIndex &ent_)
         {
-            return m_archetypes[ent_.m_archetypeId].getComponent<T>(ent_.m_entityId);
+            return m_archetypes[ent_.m_archetypeId].template getComponent<T>(ent_.m_entityId);
+        }
+
+        template<typename T>
+        T &getComponent(const EntityHandle &ent_)
+        {
+            return getComponent<T>(getAliveIndex(ent_));
         }
 
     private:
+        // Slot of an entity, maps stable id to current location
+        struct EntitySlot
+        {
+            EntityIndex m_index;
+            uint32_t m_generation = 0;
+            bool m_alive = false;
+        };
+
+        struct Observer
+        {
+            ObserverEvent m_event;
+            ComponentMask<TReg::MaxID> m_mask;
+            ObserverCallback m_callback;
+        };
+
+        // Same as getIndex, but throws if handle is not alive
+        inline const EntityIndex &getAliveIndex(const EntityHandle &ent_) const
+        {
+            if (!isAlive(ent_))
+                throw std::exception();
+
+            return m_entities[ent_.m_id].m_index;
+        }
+
+        inline bool isObserved(ObserverEvent event_) const
+        {
+            return m_observerCounts[static_cast<size_t>(event_)] > 0;
+        }
+
+        // Masks are the same for all entities of an operation, so observers are filtered once per operation
+        void notify(ObserverEvent event_, const ComponentMask<TReg::MaxID> &oldMask_, const ComponentMask<TReg::MaxID> &newMask_, std::span<const ObservedEntity> entities_)
+        {
+            if (entities_.empty())
+                return;
+
+            for (size_t i = 0; i < m_observers.size(); ++i)
+            {
+                const auto &observer = m_observers[i];
+                if (observer.m_event != event_ || !observer.m_callback)
+                    continue;
+
+                bool before = oldMask_.contains(observer.m_mask);
+                bool after = newMask_.contains(observer.m_mask);
+                if ((event_ == ObserverEvent::ADD && !before && after)
+                    || (event_ == ObserverEvent::REMOVE && before && !after)
+                    || (event_ == ObserverEvent::MOVE && before && after))
+                    observer.m_callback(entities_);
+            }
+        }
+
+        void notifySingle(ObserverEvent event_, const ComponentMask<TReg::MaxID> &oldMask_, const ComponentMask<TReg::MaxID> &newMask_, const EntityIndex &idx_)
+        {
+            ObservedEntity ent{getHandle(idx_), idx_};
+            notify(event_, oldMask_, newMask_, std::span<const ObservedEntity>(&ent, 1));
+        }
+
+        void notifyRange(ObserverEvent event_, const ComponentMask<TReg::MaxID> &oldMask_, const ComponentMask<TReg::MaxID> &newMask_, const EntityRange &range_)
+        {
+            std::vector<ObservedEntity> entities(range_.size());
+            for (size_t i = 0; i < range_.size(); ++i)
+                entities[i] = {getHandle(range_[i]), range_[i]};
+
+            notify(event_, oldMask_, newMask_, entities);
+        }
+
+        void notifyRows(ObserverEvent event_, const ComponentMask<TReg::MaxID> &oldMask_, const ComponentMask<TReg::MaxID> &newMask_, size_t archId_, std::span<const size_t> rows_)
+        {
+            std::vector<ObservedEntity> entities(rows_.size());
+            for (size_t i = 0; i < rows_.size(); ++i)
+                entities[i] = {getHandle({archId_, rows_[i]}), {archId_, rows_[i]}};
+
+            notify(event_, oldMask_, newMask_, entities);
+        }
+
+        // Entities that moved from one archetype to another, either started to match observers or kept matching them
+        void notifyTransition(size_t oldArchId_, const EntityRange &range_)
+        {
+            const auto &oldMask = m_archetypes[oldArchId_].getMask();
+            const auto &newMask = m_archetypes[range_.m_archetypeId].getMask();
+            if (isObserved(ObserverEvent::ADD))
+                notifyRange(ObserverEvent::ADD, oldMask, newMask, range_);
+
+            if (isObserved(ObserverEvent::MOVE))
+                notifyRange(ObserverEvent::MOVE, oldMask, newMask, range_);
+        }
+
+        void notifyTransition(size_t oldArchId_, const EntityIndex &idx_)
+        {
+            notifyTransition(oldArchId_, EntityRange{idx_.m_archetypeId, idx_.m_entityId, 1});
+        }
+
+        EntityId allocateEntity()
+        {
+            EntityId entity;
+            if (!m_freeEntities.empty())
+            {
+                entity = m_freeEntities.back();
+                m_freeEntities.pop_back();
+            }
+            else
+            {
+                entity = static_cast<EntityId>(m_entities.size());
+                m_entities.emplace_back();
+            }
+
+            m_entities[entity].m_alive = true;
+            return entity;
+        }
+
+        void freeEntity(EntityId entity_)
+        {
+            m_entities[entity_].m_alive = false;
+            m_entities[entity_].m_generation++;
+            m_entities[entity_].m_index = {NO_ARCHETYPE, 0};
+            m_freeEntities.push_back(entity_);
+        }
+
+        // Rows of archetype for which predicate returns true
+        template<typename F>
+        std::vector<size_t> selectRows(size_t archId_, F &pred_)
+        {
+            std::vector<size_t> rows;
+            EntityIndex idx{archId_, 0};
+            for (; idx.m_entityId < m_archetypes[archId_].size(); ++idx.m_entityId)
+            {
+                if (pred_(idx))
+                    rows.push_back(idx.m_entityId);
+            }
+
+            return rows;
+        }
+
+        /*
+            Moves listed unique rows to another archetype with sources for new components, patches slots and compacts old archetype
+            sorted_ is the same rows in ascending order
+        */
+        template<typename... Sources>
+        EntityRange moveEntitiesBatch(size_t oldArchId_, size_t newArchId_, std::span<const size_t> rows_, const std::vector<size_t> &sorted_, Sources&&... sources_)
+        {
+            auto &oldarch = m_archetypes[oldArchId_];
+            auto &newarch = m_archetypes[newArchId_];
+
+            if (isObserved(ObserverEvent::REMOVE))
+                notifyRows(ObserverEvent::REMOVE, oldarch.getMask(), newarch.getMask(), oldArchId_, rows_);
+
+            auto first = newarch.addEntitiesFrom(oldarch, rows_.data(), rows_.size(), std::forward<Sources>(sources_)...);
+            for (size_t i = 0; i < rows_.size(); ++i)
+                m_entities[newarch.getEntity(first + i)].m_index = {newArchId_, first + i};
+
+            removeRows(oldArchId_, sorted_);
+            notifyTransition(oldArchId_, EntityRange{newArchId_, first, rows_.size()});
+
+            return {newArchId_, first, rows_.size()};
+        }
+
+        // Sorted copy of rows without duplicates
+        static std::vector<size_t> sortRows(std::span<const size_t> rows_)
+        {
+            std::vector<size_t> sorted(rows_.begin(), rows_.end());
+            std::sort(sorted.begin(), sorted.end());
+            sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+            return sorted;
+        }
+
+        // Position of the last listing of every row, ordered by row
+        static std::vector<size_t> lastListings(std::span<const size_t> rows_)
+        {
+            std::vector<size_t> listings(rows_.size());
+            for (size_t i = 0; i < listings.size(); ++i)
+                listings[i] = i;
+
+            std::stable_sort(listings.begin(), listings.end(), [rows_](size_t lhs_, size_t rhs_) { return rows_[lhs_] < rows_[rhs_]; });
+
+            size_t count = 0;
+            for (size_t i = 0; i < listings.size(); ++i)
+            {
+                if (i + 1 < listings.size() && rows_[listings[i]] == rows_[listings[i + 1]])
+                    continue;
+
+                listings[count++] = listings[i];
+            }
+
+            listings.resize(count);
+            return listings;
+        }
+
+        // Generator that gives i-th entity the source element of i-th listing
+        template<typename S>
+        static auto relistSource(S &src_, const std::vector<size_t> &listings_)
+        {
+            return [&src_, &listings_](size_t i_) -> BatchComponent<S>
+            {
+                return BatchSource<std::remove_cvref_t<S>>::get(src_, listings_[i_]);
+            };
+        }
+
+        // Removes sorted unique rows in a single pass and patches slots of the entities that took their places
+        void removeRows(size_t archId_, const std::vector<size_t> &sorted_)
+        {
+            auto &arch = m_archetypes[archId_];
+            auto holes = arch.removeEntities(sorted_.data(), sorted_.size());
+            for (auto hole : holes)
+                m_entities[arch.getEntity(hole)].m_index = {archId_, hole};
+
+            if (isObserved(ObserverEvent::MOVE))
+                notifyRows(ObserverEvent::MOVE, arch.getMask(), arch.getMask(), archId_, holes);
+        }
+
+        // Swap-removes a row and patches slot of the entity that took its place
+        void removeRow(const EntityIndex &idx_)
+        {
+            auto moved = m_archetypes[idx_.m_archetypeId].removeEntity(idx_.m_entityId);
+            if (moved != INVALID_ENTITY)
+            {
+                m_entities[moved].m_index = idx_;
+
+                if (isObserved(ObserverEvent::MOVE))
+                    notifySingle(ObserverEvent::MOVE, m_archetypes[idx_.m_archetypeId].getMask(), m_archetypes[idx_.m_archetypeId].getMask(), idx_);
+            }
+        }
+
+        /*
+            Mask and its hash are compile time constants
+            Last found archetype is cached per signature (and per thread, since several registries might be used concurrently),
+            cached id is only trusted if that archetype has the same mask, so it works with any number of registries
+        */
         template<typename... Comps> requires TypeManip::TemplateExists<Comps...>
         size_t getEnsureArchetype()
         {
-            constexpr std::bitset<TReg::MaxID> bset(((1ull << (TReg::template Get<Comps>() - 1)) | ...));
+            static constexpr auto bset = makeComponentMask<TReg, Comps...>();
+            static constexpr auto hash = bset.hash();
+            static thread_local size_t cached = NO_ARCHETYPE;
+
+            if (cached < m_archetypes.size() && m_archetypes[cached].getMask() == bset)
+                return cached;
 
-            auto fnd = m_archTypes.find(bset);
+            auto fnd = m_archTypes.find(bset, hash);
 
-            if (fnd != m_archTypes.end())
+            if (fnd != NO_ARCHETYPE)
             {
-                std::cout << "Found archetype " << bset << ", creating entity there" << std::endl;
-                return fnd->second;
+                ECS_TRACE(VERBOSE, REGISTRY, "Found archetype " << bset << ", creating entity there");
             }
             else
             {
-                std::cout << "Couldn't find archetype " << bset << ", creating new" << std::endl;
-                auto newid = m_archetypes.size();
-                m_archTypes[bset] = newid;
-                m_archetypes.emplace_back();
-                m_archetypes[newid].template addTypes<Comps...>(10);
-                return newid;
+                ECS_TRACE(INFO, REGISTRY, "Couldn't find archetype " << bset << ", creating new");
+                fnd = emplaceArchetype(bset, hash);
+                m_archetypes[fnd].template addTypes<Comps...>(m_growth.m_initialCapacity);
             }
+
+            cached = fnd;
+            return fnd;
         }
 
         template<typename... Comps> requires TypeManip::TemplateExists<Comps...>
-        size_t getEnsureCopiedArchetype(size_t oldArchId_, const std::bitset<TReg::MaxID> &newMask_)
+        size_t getEnsureCopiedArchetype(size_t oldArchId_, const ComponentMask<TReg::MaxID> &newMask_)
         {
-            auto fnd = m_archTypes.find(newMask_);
+            auto hash = newMask_.hash();
+            auto fnd = m_archTypes.find(newMask_, hash);
 
-            if (fnd != m_archTypes.end())
+            if (fnd != NO_ARCHETYPE)
             {
-                std::cout << "Found archetype " << newMask_ << " by mask" << std::endl;
-                return fnd->second;
+                ECS_TRACE(VERBOSE, REGISTRY, "Found archetype " << newMask_ << " by mask");
+                return fnd;
             }
             else
             {
-                std::cout << "Couldn't find archetype " << newMask_ << " by mask" << std::endl;
-                std::size_t newid = m_archetypes.size();
-                m_archTypes[newMask_] = newid;
-                m_archetypes.emplace_back();
-                m_archetypes[newid].template addTypes<Comps...>(m_archetypes.at(oldArchId_), 10);
+                ECS_TRACE(INFO, REGISTRY, "Couldn't find archetype " << newMask_ << " by mask");
+                auto newid = emplaceArchetype(newMask_, hash);
+                m_archetypes[newid].template addTypes<Comps...>(m_archetypes.at(oldArchId_), m_growth.m_initialCapacity);
                 return newid;
             }
         }
 
-        template<int CurrentType, typename... Emplaced>
-        void recursiveEmplace(Archetype<TReg> &oldArch_, Archetype<TReg> &newArch_, std::size_t oldId_, std::size_t newId_)
+        size_t emplaceArchetype(const ComponentMask<TReg::MaxID> &mask_, size_t hash_)
         {
-            if constexpr(!(TypeManip::template isListed<typename TReg::template GetById<CurrentType>, Emplaced...>()))
+            auto newid = m_archetypes.size();
+            m_archTypes.insert(mask_, hash_, newid);
+            m_archetypes.emplace_back();
+            m_archetypes[newid].setGrowthPolicy(m_growth);
+            m_archetypes[newid].setTickSource(m_tick.get());
+
+            for (auto &[filter, cache] : m_queries)
             {
-                if (oldArch_.template containsComponents<typename TReg::template GetById<CurrentType>>())
+                if (filter.matches(mask_))
                 {
-                    newArch_.template emplaceComponents<typename TReg::template GetById<CurrentType>>(newId_, std::move(oldArch_.template getComponent<typename TReg::template GetById<CurrentType>>(oldId_)));
+                    ECS_TRACE(INFO, QUERY, "Archetype " << mask_ << " added to query " << filter.m_with << " / " << filter.m_without);
+                    cache->m_archIds.push_back(newid);
                 }
             }
 
-            if constexpr (CurrentType < TReg::MaxID)
-                recursiveEmplace<CurrentType + 1, Emplaced...>(oldArch_, newArch_, oldId_, newId_);
+            return newid;
         }
 
-        template<int CurrentType>
-        void recursiveMoveAllRequired(Archetype<TReg> &oldArch_, Archetype<TReg> &newArch_, std::size_t oldId_, std::size_t newId_)
+        // Archetype with all components from old one plus listed, uses cached transitions if possible
+        template<typename... Comps> requires TypeManip::TemplateExists<Comps...>
+        size_t getEnsureExtendedArchetype(size_t oldArchId_)
         {
-            if (newArch_.containsComponents<typename TReg::template GetById<CurrentType>>())
+            auto cached = followEdges<true, Comps...>(oldArchId_);
+            if (cached != NO_ARCHETYPE)
+                return cached;
+
+            auto newmask = extendMask<Comps...>(m_archetypes[oldArchId_].getMask());
+            auto newarch = getEnsureCopiedArchetype<Comps...>(oldArchId_, newmask);
+
+            if constexpr (sizeof...(Comps) == 1)
             {
-                newArch_.emplaceComponents(newId_, std::move(oldArch_.template getComponent<typename TReg::template GetById<CurrentType>>(oldId_)));
+                m_archetypes[oldArchId_].setAddEdge(TReg::template Get<Comps...>(), newarch);
+                m_archetypes[newarch].setRemoveEdge(TReg::template Get<Comps...>(), oldArchId_);
+            }
+
+            return newarch;
+        }
+
+        // Archetype with all components from old one except listed, uses cached transitions if possible
+        template<typename... Comps> requires TypeManip::TemplateExists<Comps...>
+        size_t getEnsureReducedArchetype(size_t oldArchId_)
+        {
+            auto cached = followEdges<false, Comps...>(oldArchId_);
+            if (cached != NO_ARCHETYPE)
+                return cached;
+
+            auto newmask = removeFromMask<Comps...>(m_archetypes[oldArchId_].getMask());
+            size_t newarch = 0;
+
+            // Ensure that archetype with same components except listed exists
+            auto hash = newmask.hash();
+            auto fnd = m_archTypes.find(newmask, hash);
+            if (fnd == NO_ARCHETYPE)
+            {
+                ECS_TRACE(INFO, REGISTRY, "Archetype " << newmask << " doesn't exist, creating new");
+                newarch = emplaceArchetype(newmask, hash);
+                m_archetypes[newarch].template addTypesReduced<Comps...>(m_archetypes[oldArchId_], m_growth.m_initialCapacity);
+            }
+            else
+                newarch = fnd;
+
+            if constexpr (sizeof...(Comps) == 1)
+            {
+                if (newarch != oldArchId_)
+                {
+                    m_archetypes[oldArchId_].setRemoveEdge(TReg::template Get<Comps...>(), newarch);
+                    m_archetypes[newarch].setAddEdge(TReg::template Get<Comps...>(), oldArchId_);
+                }
+            }
+
+            return newarch;
+        }
+
+        /*
+            Walks cached single component transitions, skipping components that are already in place
+            Returns NO_ARCHETYPE if any transition on the way is unknown
+        */
+        template<bool Add, typename... Comps>
+        size_t followEdges(size_t archId_) const
+        {
+            constexpr std::array<int, sizeof...(Comps)> comps{TReg::template Get<Comps>()...};
+            for (auto comp : comps)
+            {
+                const auto &arch = m_archetypes[archId_];
+                if (arch.containsComponent(comp) == Add)
+                    continue;
+
+                archId_ = (Add ? arch.getAddEdge(comp) : arch.getRemoveEdge(comp));
+                if (archId_ == NO_ARCHETYPE)
+                    return NO_ARCHETYPE;
             }
 
-            if constexpr (CurrentType < TReg::MaxID)
-                recursiveMoveAllRequired<CurrentType + 1>(oldArch_, newArch_, oldId_, newId_);
+            return archId_;
         }
 
         template<typename... Ts>
-        static constexpr std::bitset<TReg::MaxID> extendMask(const std::bitset<TReg::MaxID> &bitset_)
+        static constexpr ComponentMask<TReg::MaxID> extendMask(const ComponentMask<TReg::MaxID> &mask_)
         {
-            std::bitset<TReg::MaxID> bset2(((1ull << (TReg::template Get<Ts>() - 1)) | ...));
-            return bitset_ | bset2;
+            constexpr auto bset2 = makeComponentMask<TReg, Ts...>();
+            return mask_ | bset2;
         }
 
         template<typename... Ts>
-        static constexpr std::bitset<TReg::MaxID> removeFromMask(const std::bitset<TReg::MaxID> &bitset_)
+        static constexpr ComponentMask<TReg::MaxID> removeFromMask(const ComponentMask<TReg::MaxID> &mask_)
         {
-            std::bitset<TReg::MaxID> bset2(((~(1ull << (TReg::template Get<Ts>() - 1))) & ...));
-            return bitset_ & bset2;
+            constexpr auto bset2 = ~makeComponentMask<TReg, Ts...>();
+            return mask_ & bset2;
         }
 
         std::vector<Archetype<TReg>> m_archetypes;
-        std::unordered_map<std::bitset<TReg::MaxID>, size_t> m_archTypes;
+        ArchetypeIndex<TReg::MaxID> m_archTypes;
+        std::unordered_map<QueryFilter<TReg>, std::unique_ptr<QueryCache<TReg>>, typename QueryFilter<TReg>::Hash> m_queries;
+        std::vector<EntitySlot> m_entities;
+        std::vector<EntityId> m_freeEntities;
+        GrowthPolicy m_growth;
+        std::vector<Observer> m_observers;
+        std::array<size_t, 3> m_observerCounts{};
 
+        // Kept on heap so archetypes can point to it even if registry is moved
+        std::unique_ptr<std::atomic<Tick>> m_tick = std::make_unique<std::atomic<Tick>>(1);
     };
 }
 
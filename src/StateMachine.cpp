@@ -1,51 +1,95 @@
 #include "StateMachine.h"
 
-void StateMachine::addState(std::unique_ptr<GenericState> &&state_)
+void StateGraph::addState(std::unique_ptr<GenericState> &&state_)
 {
-    m_stateIds[state_->m_stateId] = m_states.size();
-    state_->setParent(this);
+    if (m_states.size() >= MAX_GRAPH_STATES)
+        throw std::exception();
+
+    if (static_cast<size_t>(state_->m_stateId) >= m_stateIds.size())
+        m_stateIds.resize(state_->m_stateId + 1, -1);
+
+    auto index = m_states.size();
+    m_stateIds[state_->m_stateId] = index;
+    m_addedIds.set(state_->m_stateId);
     m_states.push_back(std::move(state_));
+
+    // New row, states that can be entered from the added one
+    const auto &added = *m_states[index];
+    for (size_t i = 0; i <= index; ++i)
+    {
+        if (m_states[i]->transitionableFrom(added.m_stateId))
+            m_transitions[index].set(i);
+    }
+
+    // New column, only rows of states that are already in graph and listed by the added one
+    auto sources = added.getTransitionableFrom() & m_addedIds;
+    for (auto id = sources.firstSet(); id < MAX_STATE_MARKS; id = sources.firstSet())
+    {
+        m_transitions[m_stateIds[id]].set(index);
+        sources.toggleMark(id);
+    }
 }
 
-void StateMachine::switchCurrentState(ECS::EntityView &owner_, GenericState *state_)
+StateLevel::StateLevel(const StateGraph &graph_, StateMachine &machine_, size_t depth_) :
+    m_graph(&graph_),
+    m_machine(&machine_),
+    m_depth(depth_)
 {
-    m_currentState->leave(owner_, state_->m_stateId);
-    state_->enter(owner_, m_currentState->m_stateId);
-    m_currentState = state_;
-    m_framesInState = 0;
 }
 
-bool StateMachine::update(ECS::EntityView &owner_, uint32_t currentFrame_)
+const GenericState &StateLevel::getCurrentState() const
 {
-    if (m_currentState->update(owner_, m_framesInState))
-    {
-        if (!attemptTransition(owner_))
-        {
-            m_framesInState++;
-        }
-        else
-            return true;
-    }
-    else
-        m_framesInState++;
+    return m_graph->getState(m_machine->m_levels[m_depth].m_state);
+}
+
+uint32_t StateLevel::getFramesInState() const
+{
+    return m_machine->m_levels[m_depth].m_framesInState;
+}
 
+StateLevel StateLevel::getNested() const
+{
+    auto *nested = getCurrentState().getNestedGraph();
+    if (!nested || m_depth + 1 >= MAX_STATE_DEPTH)
+        throw std::exception();
+
+    return StateLevel(*nested, *m_machine, m_depth + 1);
+}
+
+void StateLevel::switchCurrentState(ECS::EntityView &owner_, const GenericState &state_)
+{
+    auto &level = m_machine->m_levels[m_depth];
+    const auto &oldState = getCurrentState();
+
+    oldState.leave(owner_, *this, state_.m_stateId);
+    level.m_state = m_graph->m_stateIds[state_.m_stateId];
+    level.m_framesInState = 0;
+    resetNested();
+    state_.enter(owner_, *this, oldState.m_stateId);
+}
+
+bool StateLevel::update(ECS::EntityView &owner_)
+{
+    if (getCurrentState().update(owner_, *this) && attemptTransition(owner_))
+        return true;
+
+    m_machine->m_levels[m_depth].m_framesInState++;
     return false;
 }
 
-bool StateMachine::attemptTransition(ECS::EntityView &owner_)
+bool StateLevel::attemptTransition(ECS::EntityView &owner_)
 {
-    auto currentStateId = m_currentState->m_stateId;
     auto &trans = owner_.get<ComponentTransform>(1);
-    for (auto &el : m_states)
+    auto candidates = m_graph->getTransitions(m_machine->m_levels[m_depth].m_state);
+    for (auto index = candidates.firstSet(); index < MAX_GRAPH_STATES; index = candidates.firstSet())
     {
-        if (!el->transitionableFrom(currentStateId))
-            continue;
-
-        auto res = el->isPossible(owner_);
+        candidates.toggleMark(index);
+        const auto &state = m_graph->getState(index);
+        auto res = state.isPossible(owner_);
         if (res != ORIENTATION::UNSPECIFIED)
         {
             trans.m_orientation = res;
-            switchCurrentState(owner_, el.get());
+            switchCurrentState(owner_, state);
             return true;
         }
     }
@@ -53,9 +97,48 @@ bool StateMachine::attemptTransition(ECS::EntityView &owner_)
     return false;
 }
 
+void StateLevel::resetNested()
+{
+    const auto *graph = getCurrentState().getNestedGraph();
+    for (size_t depth = m_depth + 1; graph; ++depth)
+    {
+        if (depth >= MAX_STATE_DEPTH)
+            throw std::exception();
+
+        m_machine->m_levels[depth] = {graph->m_initialState, 0};
+        graph = graph->getState(graph->m_initialState).getNestedGraph();
+    }
+}
+
+std::string StateLevel::getName() const
+{
+    return getCurrentState().getName(*this);
+}
+
+StateMachine::StateMachine(const StateGraph &graph_) :
+    m_graph(&graph_)
+{
+    m_levels[0] = {graph_.m_initialState, 0};
+    getRoot().resetNested();
+}
+
+StateLevel StateMachine::getRoot()
+{
+    return StateLevel(*m_graph, *this, 0);
+}
+
+bool StateMachine::update(ECS::EntityView &owner_)
+{
+    return getRoot().update(owner_);
+}
+
 std::string StateMachine::getName() const
 {
-    return std::string("root") + " -> " + m_currentState->getName(m_framesInState);
+    if (!m_graph)
+        return "root";
+
+    // StateLevel is only used to read current states here
+    return std::string("root") + " -> " + const_cast<StateMachine*>(this)->getRoot().getName();
 }
 
 std::ostream &operator<<(std::ostream &os_, const StateMachine &rhs_)
@@ -64,21 +147,16 @@ std::ostream &operator<<(std::ostream &os_, const StateMachine &rhs_)
     return os_;
 }
 
-void GenericState::setParent(StateMachine *parent_)
-{
-    m_parent = parent_;
-}
-
-void GenericState::enter(ECS::EntityView &owner_, CharState from_)
+void GenericState::enter(ECS::EntityView &, StateLevel &, CharState) const
 {
     std::cout << "Switched to " << m_stateName << std::endl;
 }
 
-void GenericState::leave(ECS::EntityView &owner_, CharState to_)
+void GenericState::leave(ECS::EntityView &, StateLevel &, CharState) const
 {
 }
 
-bool GenericState::update(ECS::EntityView &owner_, uint32_t currentFrame_)
+bool GenericState::update(ECS::EntityView &, StateLevel &) const
 {
     return true;
 }
@@ -88,18 +166,136 @@ ORIENTATION GenericState::isPossible(ECS::EntityView &owner_) const
     return owner_.get<ComponentTransform>(1).m_orientation;
 }
 
-std::string GenericState::getName(uint32_t framesInState_) const
+std::string GenericState::getName(const StateLevel &level_) const
 {
-    return m_stateName + " (" + std::to_string(framesInState_) + ")";
+    return m_stateName + " (" + std::to_string(level_.getFramesInState()) + ")";
 }
 
-std::string NodeState::getName(uint32_t framesInState_) const
+const StateGraph *GenericState::getNestedGraph() const
 {
-    return std::string(GenericState::m_stateName) + " (" + std::to_string(framesInState_) + ") -> " + StateMachine::m_currentState->getName(StateMachine::m_framesInState);
+    return nullptr;
 }
 
-bool NodeState::update(ECS::EntityView &owner_, uint32_t currentFrame_)
+void GenericState::updateBatch(std::span<StateBatchEntry> entries_) const
 {
-    GenericState::update(owner_, currentFrame_);
-    return StateMachine::update(owner_, currentFrame_);
+    for (auto &el : entries_)
+    {
+        auto level = el.m_machine->getRoot();
+        el.m_leave = update(el.m_view, level);
+    }
+}
+
+void GenericState::isPossibleBatch(std::span<StateBatchEntry> entries_) const
+{
+    for (auto &el : entries_)
+        el.m_orientation = isPossible(el.m_view);
+}
+
+void NodeState::addState(std::unique_ptr<GenericState> &&state_)
+{
+    m_graph.addState(std::move(state_));
+}
+
+std::string NodeState::getName(const StateLevel &level_) const
+{
+    return GenericState::getName(level_) + " -> " + level_.getNested().getName();
+}
+
+bool NodeState::update(ECS::EntityView &owner_, StateLevel &level_) const
+{
+    GenericState::update(owner_, level_);
+    return level_.getNested().update(owner_);
+}
+
+const StateGraph *NodeState::getNestedGraph() const
+{
+    return &m_graph;
+}
+
+StateBatch::StateBatch(const StateGraph &graph_) :
+    m_graph(&graph_)
+{
+}
+
+void StateBatch::add(const ECS::EntityView &owner_, StateMachine &machine_)
+{
+    if (machine_.m_graph != m_graph)
+        throw std::exception();
+
+    m_entries.push_back({owner_, &machine_});
+}
+
+void StateBatch::update()
+{
+    // Counting sort by current state, so every state gets a contiguous range
+    m_offsets.assign(m_graph->m_states.size() + 1, 0);
+    for (const auto &el : m_entries)
+        m_offsets[el.m_machine->m_levels[0].m_state + 1]++;
+
+    for (size_t i = 1; i < m_offsets.size(); ++i)
+        m_offsets[i] += m_offsets[i - 1];
+
+    m_sorted.resize(m_entries.size());
+    for (const auto &el : m_entries)
+        m_sorted[m_offsets[el.m_machine->m_levels[0].m_state]++] = el;
+
+    // Offsets were moved to the end of each range
+    for (size_t state = 0, first = 0; state < m_graph->m_states.size(); ++state)
+    {
+        auto last = m_offsets[state];
+        if (first == last)
+            continue;
+
+        const auto &current = m_graph->getState(state);
+        std::span<StateBatchEntry> range(m_sorted.data() + first, last - first);
+        current.updateBatch(range);
+
+        m_pending.clear();
+        for (auto &el : range)
+        {
+            if (el.m_leave)
+                m_pending.push_back(el);
+            else
+                el.m_machine->m_levels[0].m_framesInState++;
+        }
+
+        if (!m_pending.empty())
+            attemptTransitions(state);
+
+        first = last;
+    }
+
+    m_entries.clear();
+}
+
+void StateBatch::attemptTransitions(int from_)
+{
+    auto candidates = m_graph->getTransitions(from_);
+    for (auto index = candidates.firstSet(); index < MAX_GRAPH_STATES; index = candidates.firstSet())
+    {
+        if (m_pending.empty())
+            return;
+
+        candidates.toggleMark(index);
+        const auto &el = m_graph->getState(index);
+        el.isPossibleBatch(m_pending);
+
+        size_t left = 0;
+        for (auto &entry : m_pending)
+        {
+            if (entry.m_orientation != ORIENTATION::UNSPECIFIED)
+            {
+                entry.m_view.get<ComponentTransform>(1).m_orientation = entry.m_orientation;
+                entry.m_machine->getRoot().switchCurrentState(entry.m_view, el);
+            }
+            else
+                m_pending[left++] = entry;
+        }
+
+        m_pending.resize(left);
+    }
+
+    // Entities that stay in their state
+    for (auto &entry : m_pending)
+        entry.m_machine->m_levels[0].m_framesInState++;
 }
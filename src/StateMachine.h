@@ -5,67 +5,180 @@
 #include "Vector2.h"
 #include "StateMarker.hpp"
 #include "ExampleComponents.h"
+#include <span>
 
 using CharState = int;
 
+// Maximal depth of nested states, every level takes 8 bytes in StateMachine
+constexpr inline size_t MAX_STATE_DEPTH = 4;
+
+// Maximal amount of states in a single graph, every row of transition table has a mark per state
+constexpr inline size_t MAX_GRAPH_STATES = STATE_HOLDER_SIZE;
+
+// Indexes of states within a graph
+using GraphStateMarker = BasicStateMarker<MAX_GRAPH_STATES>;
+
 class GenericState;
+class StateMachine;
 
-class StateMachine
+/*
+    Immutable set of states of a single level, built once and shared by state machines of any amount of entities
+    Owns its states, so it should outlive every state machine that uses it
+    Keeps a transition table that is filled as states are added: row per source state, bit per target state index
+*/
+class StateGraph
 {
 public:
-    StateMachine() = default;
-    StateMachine(const StateMachine &) = delete;
-    StateMachine(StateMachine &&) = default;
-    StateMachine &operator=(const StateMachine &) = delete;
-    StateMachine &operator=(StateMachine &&) = default;
+    StateGraph() = default;
+    StateGraph(const StateGraph &) = delete;
+    StateGraph(StateGraph &&) = default;
+    StateGraph &operator=(const StateGraph &) = delete;
+    StateGraph &operator=(StateGraph &&) = default;
 
     void addState(std::unique_ptr<GenericState> &&state_);
-    void switchCurrentState(ECS::EntityView &owner_, GenericState *state_);
-    bool attemptTransition(ECS::EntityView &owner_);
 
-    virtual bool update(ECS::EntityView &owner_, uint32_t currentFrame_);
-    virtual std::string getName() const;
+    template<typename PLAYER_STATE_T>
+    inline void setInitialState(PLAYER_STATE_T state_)
+    {
+        m_initialState = m_stateIds[static_cast<CharState>(state_)];
+    }
+
+    inline const GenericState &getState(int index_) const
+    {
+        return *m_states[index_];
+    }
+
+    // Indexes of states that can be entered from state with index_, lower index has higher priority
+    inline const GraphStateMarker &getTransitions(int index_) const
+    {
+        return m_transitions[index_];
+    }
+
+    std::vector<std::unique_ptr<GenericState>> m_states;
+    std::vector<int> m_stateIds; // Index of a state by its id, -1 for ids without states
+    int m_initialState = 0;
+
+private:
+    std::array<GraphStateMarker, MAX_GRAPH_STATES> m_transitions{};
+    StateMarker m_addedIds; // Ids of added states
+};
+
+/*
+    Single level of a state machine of an entity: shared graph of that level plus current state of the entity in it
+    Passed to states, so they can check how long they are active and control their nested states
+    Only references StateMachine component, so it is outdated as soon as the component moves
+*/
+class StateLevel
+{
+public:
+    StateLevel(const StateGraph &graph_, StateMachine &machine_, size_t depth_);
+
+    const GenericState &getCurrentState() const;
+    uint32_t getFramesInState() const;
+
+    // Level of nested states of the current state, throws if current state doesn't have them
+    StateLevel getNested() const;
+
+    /*
+        Leaves current state and enters state_, nested states of state_ always start from their initial ones
+        Nested levels are kept per depth, not per state, so there is nothing to resume when a state is entered again
+    */
+    void switchCurrentState(ECS::EntityView &owner_, const GenericState &state_);
 
     template<typename PLAYER_STATE_T>
     void switchCurrentState(ECS::EntityView &owner_, PLAYER_STATE_T stateId_)
     {
-        switchCurrentState(owner_, m_states[m_stateIds[static_cast<CharState>(stateId_)]].get());
+        switchCurrentState(owner_, m_graph->getState(m_graph->m_stateIds[static_cast<CharState>(stateId_)]));
     }
-    
+
+    // Updates current state and switches to the first possible state if current one allows it, returns true if state changed
+    bool update(ECS::EntityView &owner_);
+    bool attemptTransition(ECS::EntityView &owner_);
+
+    // Puts every level below this one into initial states of their graphs without calling enter / leave
+    void resetNested();
+
+    std::string getName() const;
+
+private:
+    const StateGraph *m_graph;
+    StateMachine *m_machine;
+    size_t m_depth;
+};
+
+/*
+    Per entity runtime of a state machine, states themselves live in a shared StateGraph
+    Only keeps current state and frames in it for every level of nested states, so creating it never allocates
+*/
+class StateMachine
+{
+public:
+    struct Level
+    {
+        int m_state = -1;
+        uint32_t m_framesInState = 0;
+    };
+
+    StateMachine() = default;
+
+    // Starts in initial states of the graph and all nested graphs
+    StateMachine(const StateGraph &graph_);
+
+    StateLevel getRoot();
+    bool update(ECS::EntityView &owner_);
+    std::string getName() const;
+
     template<typename PLAYER_STATE_T>
-    inline void setInitialState(PLAYER_STATE_T state_)
+    void switchCurrentState(ECS::EntityView &owner_, PLAYER_STATE_T stateId_)
     {
-        auto initstate = static_cast<CharState>(state_);
-        m_framesInState = 0;
-        m_currentState = m_states[m_stateIds[initstate]].get();
+        getRoot().switchCurrentState(owner_, stateId_);
     }
 
-    std::vector<std::unique_ptr<GenericState>> m_states;
-    std::unordered_map<CharState, int> m_stateIds;
-
-    GenericState *m_currentState = nullptr;
-    uint32_t m_framesInState = 0;
+    const StateGraph *m_graph = nullptr;
+    std::array<Level, MAX_STATE_DEPTH> m_levels;
 };
 
 std::ostream &operator<<(std::ostream &os_, const StateMachine &rhs_);
 
+// Entity in a batched update, states write results of update and isPossible into it
+struct StateBatchEntry
+{
+    ECS::EntityView m_view;
+    StateMachine *m_machine = nullptr;
+    bool m_leave = false;
+    ORIENTATION m_orientation = ORIENTATION::UNSPECIFIED;
+};
+
+/*
+    Definition of a state, shared by every entity that uses its graph, so it should not keep any per entity data
+    Per entity data is either in components or in StateLevel
+    States it can be entered from are passed as a marker sized for the enum of the state,
+    enums that don't fit into StateMarker are rejected at compile time
+*/
 class GenericState
 {
 public:
     template<typename PLAYER_STATE_T>
-    GenericState(PLAYER_STATE_T stateId_, const std::string &stateName_, StateMarker &&transitionableFrom_) :
+    GenericState(PLAYER_STATE_T stateId_, const std::string &stateName_, EnumStateMarker<PLAYER_STATE_T> &&transitionableFrom_) :
         m_stateId(static_cast<CharState>(stateId_)),
-        m_stateName(stateName_),
-        m_transitionableFrom(std::move(transitionableFrom_))
-    {}
-
-    void setParent(StateMachine *parent_);
+        m_transitionableFrom(transitionableFrom_),
+        m_stateName(stateName_)
+    {
+        static_assert(StateEnumSize<PLAYER_STATE_T>::value <= MAX_STATE_MARKS, "Too many states in enum for StateMarker");
+    }
 
-    virtual void enter(ECS::EntityView &owner_, CharState from_);
-    virtual void leave(ECS::EntityView &owner_, CharState to_);
-    virtual bool update(ECS::EntityView &owner_, uint32_t currentFrame_);
+    virtual void enter(ECS::EntityView &owner_, StateLevel &level_, CharState from_) const;
+    virtual void leave(ECS::EntityView &owner_, StateLevel &level_, CharState to_) const;
+    virtual bool update(ECS::EntityView &owner_, StateLevel &level_) const;
     virtual ORIENTATION isPossible(ECS::EntityView &owner_) const;
-    virtual std::string getName(uint32_t framesInState_) const;
+    virtual std::string getName(const StateLevel &level_) const;
+
+    // Graph of nested states, nullptr if there are none
+    virtual const StateGraph *getNestedGraph() const;
+
+    // Batched versions of update and isPossible for entities in root level of StateBatch, default ones call them for every entity
+    virtual void updateBatch(std::span<StateBatchEntry> entries_) const;
+    virtual void isPossibleBatch(std::span<StateBatchEntry> entries_) const;
 
     template<typename PLAYER_STATE_T>
     bool transitionableFrom(PLAYER_STATE_T state_) const
@@ -73,27 +186,100 @@ public:
         return m_transitionableFrom[state_];
     }
 
+    inline const StateMarker &getTransitionableFrom() const
+    {
+        return m_transitionableFrom;
+    }
+
+    virtual ~GenericState() = default;
+
     const CharState m_stateId;
 
 protected:
     const StateMarker m_transitionableFrom;
     std::string m_stateName;
-    StateMachine *m_parent = nullptr;
 };
 
 /*
-    Probably not very useful because you most likely will want to use different base classes
+    State with its own graph of nested states, which are updated while it is active
+    Every time it is entered, nested states start from the initial one
 */
-class NodeState: public StateMachine, public GenericState
+class NodeState: public GenericState
 {
 public:
     template<typename PLAYER_STATE_T>
-    NodeState(PLAYER_STATE_T stateId_, const std::string &stateName_, StateMarker &&transitionableFrom_) :
+    NodeState(PLAYER_STATE_T stateId_, const std::string &stateName_, EnumStateMarker<PLAYER_STATE_T> &&transitionableFrom_) :
         GenericState(stateId_, stateName_, std::move(transitionableFrom_))
     {}
 
-    virtual std::string getName(uint32_t framesInState_) const override;
-    virtual bool update(ECS::EntityView &owner_, uint32_t currentFrame_) override;
+    void addState(std::unique_ptr<GenericState> &&state_);
+
+    template<typename PLAYER_STATE_T>
+    inline void setInitialState(PLAYER_STATE_T state_)
+    {
+        m_graph.setInitialState(state_);
+    }
+
+    virtual std::string getName(const StateLevel &level_) const override;
+    virtual bool update(ECS::EntityView &owner_, StateLevel &level_) const override;
+    virtual const StateGraph *getNestedGraph() const override;
+
+protected:
+    StateGraph m_graph;
+};
+
+/*
+    Base for states that are expected to be updated by StateBatch
+    Calls update and isPossible of DERIVED directly, so there is only one virtual call per state per frame instead of one per entity
+    BASE can be replaced with NodeState or other class derived from GenericState
+*/
+template<typename DERIVED, typename BASE = GenericState>
+class BatchState: public BASE
+{
+public:
+    using BASE::BASE;
+
+    virtual void updateBatch(std::span<StateBatchEntry> entries_) const override
+    {
+        const auto &self = static_cast<const DERIVED&>(*this);
+        for (auto &el : entries_)
+        {
+            auto level = el.m_machine->getRoot();
+            el.m_leave = self.DERIVED::update(el.m_view, level);
+        }
+    }
+
+    virtual void isPossibleBatch(std::span<StateBatchEntry> entries_) const override
+    {
+        const auto &self = static_cast<const DERIVED&>(*this);
+        for (auto &el : entries_)
+            el.m_orientation = self.DERIVED::isPossible(el.m_view);
+    }
+};
+
+/*
+    Updates state machines of many entities that share the same graph, grouped by current root state
+    Entities are added every frame and sorted by their current state, then every state is updated for all its entities at once
+    and every candidate state checks all leaving entities at once
+    Views and machines should stay valid until update, which also forgets all added entities
+    Nested states are still updated by their node states
+*/
+class StateBatch
+{
+public:
+    StateBatch(const StateGraph &graph_);
+
+    void add(const ECS::EntityView &owner_, StateMachine &machine_);
+    void update();
+
+private:
+    void attemptTransitions(int from_);
+
+    const StateGraph *m_graph;
+    std::vector<StateBatchEntry> m_entries;
+    std::vector<StateBatchEntry> m_sorted;
+    std::vector<StateBatchEntry> m_pending;
+    std::vector<size_t> m_offsets;
 };
 
-#endif
\ No newline at end of file
+#endif
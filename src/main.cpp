@@ -3,6 +3,8 @@
 #include "TypeManip.hpp"
 #include "ExampleComponents.h"
 #include "yaECS.hpp"
+#include "Scheduler.hpp"
+#include "CommandBuffer.hpp"
 #include "StateMachine.h"
 #include <iostream>
 #include <unordered_map>
@@ -44,9 +46,9 @@ public:
 
     }
 
-    inline virtual void enter(ECS::EntityView &owner_, CharState from_) override
+    inline virtual void enter(ECS::EntityView &owner_, StateLevel &level_, CharState from_) const override
     {
-        GenericState::enter(owner_, from_);
+        GenericState::enter(owner_, level_, from_);
 
         auto &trans = owner_.get<Components, ComponentTransform>();
         auto &phys = owner_.get<Components, ComponentPhysical>();
@@ -61,9 +63,9 @@ public:
         }
     }
 
-    inline virtual bool update(ECS::EntityView &owner_, uint32_t currentFrame_) override
+    inline virtual bool update(ECS::EntityView &owner_, StateLevel &level_) const override
     {
-        GenericState::update(owner_, currentFrame_);
+        GenericState::update(owner_, level_);
 
         auto &trans = owner_.get<Components, ComponentTransform>();
         auto &inp = owner_.get<Components, ComponentPlayerInput>();
@@ -94,15 +96,15 @@ protected:
 };
 
 template<typename PLAYER_STATE_T>
-class StateIdle : public GenericState
+class StateIdle : public BatchState<StateIdle<PLAYER_STATE_T>>
 {
 public:
-    StateIdle(PLAYER_STATE_T state_, StateMarker &&transitionableFrom_) :
-        GenericState(state_, "Idle", std::move(transitionableFrom_))
+    StateIdle(PLAYER_STATE_T state_, EnumStateMarker<PLAYER_STATE_T> &&transitionableFrom_) :
+        BatchState<StateIdle<PLAYER_STATE_T>>(state_, "Idle", std::move(transitionableFrom_))
     {
     }
 
-    inline virtual void enter(ECS::EntityView &owner_, CharState from_)
+    inline virtual void enter(ECS::EntityView &owner_, StateLevel &, CharState) const
     {
         if (owner_.contains<Components, ComponentPhysical>())
         {
@@ -113,19 +115,19 @@ public:
 };
 
 
-class StateMobNavigation : public GenericState
+class StateMobNavigation : public BatchState<StateMobNavigation>
 {
 public:
-    StateMobNavigation(MobStates state_, float horSpeed_, StateMarker &&transitionableFrom_) :
-        GenericState(state_, "Move dir", std::move(transitionableFrom_)),
+    StateMobNavigation(MobStates state_, float horSpeed_, EnumStateMarker<MobStates> &&transitionableFrom_) :
+        BatchState(state_, "Move dir", std::move(transitionableFrom_)),
         m_horSpeed(horSpeed_)
     {
 
     }
 
-    inline virtual void enter(ECS::EntityView &owner_, CharState from_) override
+    inline virtual void enter(ECS::EntityView &owner_, StateLevel &level_, CharState from_) const override
     {
-        GenericState::enter(owner_, from_);
+        GenericState::enter(owner_, level_, from_);
 
         auto &trans = owner_.get<Components, ComponentTransform>();
         auto &phys = owner_.get<Components, ComponentPhysical>();
@@ -143,9 +145,9 @@ public:
         }
     }
 
-    inline virtual bool update(ECS::EntityView &owner_, uint32_t currentFrame_) override
+    inline virtual bool update(ECS::EntityView &owner_, StateLevel &level_) const override
     {
-        GenericState::update(owner_, currentFrame_);
+        GenericState::update(owner_, level_);
 
         auto &mobdata = owner_.get<Components, ComponentMobNavigation>();
         return (mobdata.framesLeft-- <= 0);
@@ -165,42 +167,43 @@ protected:
     int m_horSpeed;
 };
 
-class StateMobMetaRoam : public NodeState
+class StateMobMetaRoam : public BatchState<StateMobMetaRoam, NodeState>
 {
 public:
     StateMobMetaRoam() :
-        NodeState(MobStates::META_ROAM, "ROAM", {MobStates::NONE, {MobStates::META_CHASE}})
+        BatchState(MobStates::META_ROAM, "ROAM", {MobStates::NONE, {MobStates::META_CHASE}})
     {
     }
 
-    inline virtual void enter(ECS::EntityView &owner_, CharState from_) override
+    inline virtual void enter(ECS::EntityView &owner_, StateLevel &level_, CharState) const override
     {
         auto &mobdata = owner_.get<Components, ComponentMobNavigation>();
         mobdata.framesLeft = 10;
         mobdata.dir = (rand() % 2) * 2 - 1;
-        switchCurrentState(owner_, MobStates::WALK);
+        level_.getNested().switchCurrentState(owner_, MobStates::WALK);
     }
 
-    virtual bool update(ECS::EntityView &owner_, uint32_t currentFrame_) override
+    virtual bool update(ECS::EntityView &owner_, StateLevel &level_) const override
     {
         auto &mobdata = owner_.get<Components, ComponentMobNavigation>();
 
-        auto res = NodeState::update(owner_, currentFrame_);
+        auto res = NodeState::update(owner_, level_);
+        auto nested = level_.getNested();
         if (res)
         {
-            if (m_currentState->m_stateId == static_cast<CharState>(MobStates::IDLE))
+            if (nested.getCurrentState().m_stateId == static_cast<CharState>(MobStates::IDLE))
             {
                 mobdata.framesLeft = 5;
                 mobdata.dir = 0;
             }
         }
-        else if (m_currentState->m_stateId == static_cast<CharState>(MobStates::IDLE))
+        else if (nested.getCurrentState().m_stateId == static_cast<CharState>(MobStates::IDLE))
         {
             if (mobdata.framesLeft == 0)
             {
                 mobdata.framesLeft = 10;
                 mobdata.dir = (rand() % 2) * 2 - 1;
-                switchCurrentState(owner_, MobStates::WALK);
+                nested.switchCurrentState(owner_, MobStates::WALK);
             }
             else
             {
@@ -209,7 +212,7 @@ public:
             }
         }
 
-        if (currentFrame_ >= 10)
+        if (level_.getFramesInState() >= 10)
             return true;
         
         return false;
@@ -218,24 +221,24 @@ public:
 
 };
 
-class StateMobMetaChase : public NodeState
+class StateMobMetaChase : public BatchState<StateMobMetaChase, NodeState>
 {
 public:
     StateMobMetaChase() :
-        NodeState(MobStates::META_CHASE, "CHASE", {MobStates::NONE, {MobStates::META_ROAM}})
+        BatchState(MobStates::META_CHASE, "CHASE", {MobStates::NONE, {MobStates::META_ROAM}})
     {
     }
 
-    inline virtual void enter(ECS::EntityView &owner_, CharState from_) override
+    inline virtual void enter(ECS::EntityView &owner_, StateLevel &level_, CharState) const override
     {
-        switchCurrentState(owner_, MobStates::RUN);
+        level_.getNested().switchCurrentState(owner_, MobStates::RUN);
     }
 
-    virtual bool update(ECS::EntityView &owner_, uint32_t currentFrame_) override
+    virtual bool update(ECS::EntityView &owner_, StateLevel &level_) const override
     {
-        auto res = NodeState::update(owner_, currentFrame_);
+        auto res = NodeState::update(owner_, level_);
 
-        if (currentFrame_ >= 15)
+        if (level_.getFramesInState() >= 15)
             return true;
         
         return false;
@@ -249,6 +252,9 @@ public:
 
 struct PhysicsSystem
 {
+    using Reads = TypeManip::Typelist<>;
+    using Writes = TypeManip::Typelist<ComponentTransform, ComponentPhysical>;
+
     PhysicsSystem(ECS::Registry<Components> &reg_) :
         m_physical{reg_.makeQuery<ComponentTransform, ComponentPhysical>()}
     {
@@ -271,6 +277,9 @@ struct PhysicsSystem
 
 struct InputSystem
 {
+    using Reads = TypeManip::Typelist<>;
+    using Writes = TypeManip::Typelist<ComponentPlayerInput>;
+
     InputSystem(ECS::Registry<Components> &reg_) :
         m_inq{reg_.makeQuery<ComponentPlayerInput>()}
     {
@@ -288,7 +297,6 @@ struct InputSystem
         if (buf.contains('r') || buf.contains('R'))
             r = true;
 
-        m_inq.update();
 
         m_inq.revapply<ComponentPlayerInput>([l, r](const auto &idx_, ComponentPlayerInput &inp_)
         {
@@ -313,6 +321,9 @@ struct InputSystem
 
 struct RenderSystem
 {
+    using Reads = TypeManip::Typelist<ComponentTransform, ComponentPhysical, ComponentCharacter, ComponentPlayerInput, ComponentMobNavigation, StateMachine>;
+    using Writes = TypeManip::Typelist<>;
+
     RenderSystem(ECS::Registry<Components> &reg_) :
         m_renderable{reg_.makeQuery<ComponentTransform>()}
     {
@@ -322,7 +333,6 @@ struct RenderSystem
     void update()
     {
         std::cout << "=== RENDERING ===\n";
-        m_renderable.update();
         m_renderable.applyview([](const ECS::EntityIndex &idx_, ECS::CheapEntityView<Components> view_)
         {
             iteratePrint<1>(view_);
@@ -350,81 +360,127 @@ struct RenderSystem
 struct PlayerStateSystem
 {
 public:
+    using Reads = TypeManip::Typelist<ComponentPlayerInput>;
+    using Writes = TypeManip::Typelist<ComponentTransform, ComponentPhysical, StateMachine>;
+
     PlayerStateSystem(ECS::Registry<Components> &reg_) :
         m_query{reg_.makeQuery<ComponentPlayerInput, StateMachine>()},
         m_reg(reg_)
     {
+        m_graph.addState(std::unique_ptr<StateIdle<PlayerStates>>(new StateIdle<PlayerStates>(PlayerStates::IDLE, {PlayerStates::NONE, {PlayerStates::RUN}})));
+        m_graph.addState(std::unique_ptr<StateRun>(new StateRun(5.0f)));
+        m_graph.setInitialState(PlayerStates::IDLE);
     }
 
     void initAll()
     {
-        m_query.update();
-        m_query.revapply<StateMachine>([](const auto &idx_, StateMachine &smc_)
+        m_query.revapply<StateMachine>([&graph = this->m_graph](const auto &idx_, StateMachine &smc_)
         {
-            smc_.addState(std::unique_ptr<StateIdle<PlayerStates>>(new StateIdle<PlayerStates>(PlayerStates::IDLE, {PlayerStates::NONE, {PlayerStates::RUN}})));
-            smc_.addState(std::unique_ptr<StateRun>(new StateRun(5.0f)));
-            smc_.setInitialState(PlayerStates::IDLE);
+            smc_ = StateMachine(graph);
         });
     }
 
     void updateAll()
     {
-        m_query.update();
         m_query.revapply<StateMachine>([&reg = this->m_reg](const auto &idx_, StateMachine &smc_)
         {
-            auto view = reg[idx_.m_archetypeId].makeView<ComponentTransform, ComponentPhysical, ComponentPlayerInput>(idx_.m_entityId);
-            smc_.update(view, 0);
+            auto view = reg[idx_.m_archetypeId].template makeView<ComponentTransform, ComponentPhysical, ComponentPlayerInput>(idx_.m_entityId);
+            smc_.update(view);
         });
     }
 
 private:
     ECS::Query<Components> m_query;
     ECS::Registry<Components> &m_reg;
+    StateGraph m_graph;
 };
 
 struct MobStateSystem
 {
 public:
+    using Reads = TypeManip::Typelist<>;
+    using Writes = TypeManip::Typelist<ComponentTransform, ComponentPhysical, ComponentMobNavigation, StateMachine>;
+
     MobStateSystem(ECS::Registry<Components> &reg_) :
         m_query{reg_.makeQuery<ComponentTransform, ComponentMobNavigation, StateMachine>()},
-        m_reg(reg_)
+        m_reg(reg_),
+        m_batch(m_graph)
     {
+        auto tmproam = std::unique_ptr<StateMobMetaRoam>(new StateMobMetaRoam());
+        tmproam->addState(std::unique_ptr<StateMobNavigation>(new StateMobNavigation(MobStates::WALK, 2.0f, {MobStates::NONE, {MobStates::IDLE}})));
+        tmproam->addState(std::unique_ptr<StateIdle<MobStates>>(new StateIdle<MobStates>(MobStates::IDLE, {MobStates::NONE, {MobStates::WALK, MobStates::RUN}})));
+        tmproam->setInitialState(MobStates::IDLE);
+
+        auto tmpchase = std::unique_ptr<StateMobMetaChase>(new StateMobMetaChase());
+        tmpchase->addState(std::unique_ptr<StateMobNavigation>(new StateMobNavigation(MobStates::RUN, 5.0f, {MobStates::NONE, {MobStates::IDLE, MobStates::WALK}})));
+        tmpchase->setInitialState(MobStates::RUN);
+
+        m_graph.addState(std::move(tmproam));
+        m_graph.addState(std::move(tmpchase));
+
+        m_graph.setInitialState(MobStates::META_ROAM);
     }
 
+    // Every mob shares the same graph, so this only resets their current states
     void initAll()
     {
-        m_query.update();
-        m_query.revapply<StateMachine>([](const auto &idx_, StateMachine &smc_)
+        m_query.revapply<StateMachine>([&graph = this->m_graph](const auto &idx_, StateMachine &smc_)
         {
-            auto tmproam = std::unique_ptr<StateMobMetaRoam>(new StateMobMetaRoam());
-            tmproam->addState(std::unique_ptr<StateMobNavigation>(new StateMobNavigation(MobStates::WALK, 2.0f, {MobStates::NONE, {MobStates::IDLE}})));
-            tmproam->addState(std::unique_ptr<StateIdle<MobStates>>(new StateIdle<MobStates>(MobStates::IDLE, {MobStates::NONE, {MobStates::WALK, MobStates::RUN}})));
-            tmproam->setInitialState(MobStates::IDLE);
-
-            auto tmpchase = std::unique_ptr<StateMobMetaChase>(new StateMobMetaChase());
-            tmpchase->addState(std::unique_ptr<StateMobNavigation>(new StateMobNavigation(MobStates::RUN, 5.0f, {MobStates::NONE, {MobStates::IDLE, MobStates::WALK}})));
-            tmpchase->setInitialState(MobStates::RUN);
-
-            smc_.addState(std::move(tmproam));
-            smc_.addState(std::move(tmpchase));
-
-            smc_.setInitialState(MobStates::META_ROAM);
+            smc_ = StateMachine(graph);
         });
     }
 
     void updateAll()
     {
-        m_query.update();
-        m_query.revapply<StateMachine>([&reg = this->m_reg](const auto &idx_, StateMachine &smc_)
+        // Mobs are grouped by their current state, so each state is updated for all of them at once
+        m_query.revapply<StateMachine>([&reg = this->m_reg, &batch = this->m_batch](const auto &idx_, StateMachine &smc_)
         {
-            auto view = reg[idx_.m_archetypeId].makeView<ComponentTransform, ComponentPhysical, ComponentMobNavigation>(idx_.m_entityId);
-            smc_.update(view, 0);
+            auto view = reg[idx_.m_archetypeId].template makeView<ComponentTransform, ComponentPhysical, ComponentMobNavigation>(idx_.m_entityId);
+            batch.add(view, smc_);
         });
+
+        m_batch.update();
     }
 
 private:
     ECS::Query<Components> m_query;
     ECS::Registry<Components> &m_reg;
+    StateGraph m_graph;
+    StateBatch m_batch;
+};
+
+// Removes mobs that fell too far, removals are recorded while systems run and applied after all of them are finished
+struct DespawnSystem
+{
+    using Reads = TypeManip::Typelist<ComponentTransform, ComponentMobNavigation>;
+    using Writes = TypeManip::Typelist<>;
+
+    DespawnSystem(ECS::Registry<Components> &reg_, float maxDepth_) :
+        m_mobs{reg_.makeQuery<ComponentTransform, ComponentMobNavigation>()},
+        m_reg(reg_),
+        m_maxDepth(maxDepth_)
+    {
+        
+    }
+
+    void update()
+    {
+        m_mobs.apply<const ComponentTransform>([this](const ECS::EntityIndex &idx_, const ComponentTransform &transform_)
+        {
+            if (transform_.m_pos.y > m_maxDepth)
+                m_commands.removeEntity(m_reg.getHandle(idx_));
+        });
+    }
+
+    void applyCommands()
+    {
+        m_commands.apply(m_reg);
+    }
+
+    ECS::Query<Components> m_mobs;
+    ECS::Registry<Components> &m_reg;
+    ECS::CommandBuffer<Components> m_commands;
+    float m_maxDepth;
 };
 
 void doNothing()
@@ -434,35 +490,62 @@ void doNothing()
 
 int main(int argc, char* args[])
 {
-    MultiCallImpl<void, 1> mc(doNothing, [](){std::cout << "Do nothing 2\n";});
+    MultiCallImpl<void, 2> mc(doNothing, [](){std::cout << "Do nothing 2\n";});
 
     mc();
 
-    /*ECS::Registry<Components> reg;
+    ECS::Registry<Components> reg;
+
+    // Batch operations report all their entities at once
+    reg.observe<ComponentMobNavigation>(ECS::ObserverEvent::ADD, [](std::span<const ECS::ObservedEntity> entities_)
+    {
+        std::cout << "Mobs spawned: " << entities_.size() << std::endl;
+    });
+    reg.observe<ComponentMobNavigation>(ECS::ObserverEvent::REMOVE, [](std::span<const ECS::ObservedEntity> entities_)
+    {
+        std::cout << "Mobs despawned: " << entities_.size() << std::endl;
+    });
+
     reg.createEntity<ComponentTransform, ComponentPhysical, ComponentCharacter, ComponentPlayerInput, StateMachine>(
         ComponentTransform(), ComponentPhysical({2.3f, 39.9f, 10.0f, 15.0f}, 9.8f), ComponentCharacter("Nameless1", 1), ComponentPlayerInput());
     reg.createEntity<ComponentTransform, ComponentPhysical, ComponentCharacter, ComponentMobNavigation, StateMachine>(
         ComponentPhysical({2.3f, 39.9f, 10.0f, 15.0f}, 0.1f), ComponentCharacter("Scary Skeleton", 3) );
 
+    // Wave of mobs is created in a single archetype first and then gets physics in one move
+    auto wave = reg.createEntities<ComponentTransform, ComponentCharacter, ComponentMobNavigation, StateMachine>(3,
+        [](size_t i_) { return ComponentCharacter("Skeleton " + std::to_string(i_ + 1), 1); });
+    reg.emplaceComponentsBatch(wave.m_archetypeId, [](const ECS::EntityIndex &) { return true; },
+        [](size_t i_) { return ComponentPhysical({2.3f, 39.9f, 10.0f, 15.0f}, 0.2f * (i_ + 1)); });
+
     PlayerStateSystem m_st(reg);
     MobStateSystem m_mbst(reg);
     PhysicsSystem phys(reg);
     RenderSystem ren(reg);
     InputSystem inp(reg);
+    DespawnSystem despawn(reg, 30.0f);
 
     m_st.initAll();
     m_mbst.initAll();
 
+    // Input is polled separately since it decides when to stop, the rest only run in parallel when their access allows it
+    ECS::JobSystem jobs;
+    ECS::Scheduler<Components> scheduler(jobs);
+    scheduler.addSystem<PlayerStateSystem::Reads, PlayerStateSystem::Writes>("PlayerState", [&m_st]() { m_st.updateAll(); });
+    scheduler.addSystem<MobStateSystem::Reads, MobStateSystem::Writes>("MobState", [&m_mbst]() { m_mbst.updateAll(); });
+    scheduler.addSystem(phys, "Physics");
+    scheduler.addSystem(ren, "Render");
+    scheduler.addSystem(despawn, "Despawn");
+
     bool isRunning = true;
 
     while (isRunning)
     {
         isRunning = inp.update();
-        m_st.updateAll();
-        m_mbst.updateAll();
-        phys.update();
-        ren.update();
-    }*/
+        scheduler.run();
+        despawn.applyCommands();
+    }
+
+    scheduler.dumpTimings(std::cout);
     /*ECS::Registry<Components> reg;
     reg.createEntity<ComponentTransform, ComponentPhysical, ComponentCharacter, ComponentPlayerInput, StateMachine<Components>>(
         ComponentTransform(), ComponentPhysical({2.3f, 39.9f, 10.0f, 15.0f}, 9.8f), ComponentCharacter("Nameless1", 1), ComponentPlayerInput(), StateMachine<Components>());